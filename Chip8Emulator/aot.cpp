@@ -0,0 +1,128 @@
+#include "aot.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+Aot::Aot() {
+	for (int i = 0; i < 4096; ++i) {
+		blockIndex[i] = nullptr;
+		covered[i] = false;
+	}
+}
+
+Aot::~Aot() {
+	unload();
+}
+
+bool Aot::load(const std::string& path, const uint8_t* memory, std::string& error) {
+	unload();
+
+	AotModuleFunction entry = nullptr;
+
+#ifdef _WIN32
+	HMODULE handle = LoadLibraryA(path.c_str());
+	if (handle == nullptr) {
+		error = "could not load " + path;
+		return false;
+	}
+
+	library = handle;
+	entry = reinterpret_cast<AotModuleFunction>(GetProcAddress(handle, CHIP8_AOT_ENTRY));
+#else
+	library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (library == nullptr) {
+		error = dlerror();
+		return false;
+	}
+
+	entry = reinterpret_cast<AotModuleFunction>(dlsym(library, CHIP8_AOT_ENTRY));
+#endif
+
+	if (entry == nullptr) {
+		error = path + " is not a recompiled CHIP-8 program";
+		unload();
+		return false;
+	}
+
+	const AotModule* loaded = entry();
+
+	if (loaded->version != CHIP8_AOT_VERSION) {
+		error = path + " was built for a different version of the emulator";
+		unload();
+		return false;
+	}
+
+	if (loaded->programHash != hashProgramMemory(memory)) {
+		error = path + " was built from a different program";
+		unload();
+		return false;
+	}
+
+	module = loaded;
+
+	for (uint32_t i = 0; i < module->blockCount; ++i) {
+		const AotBlock& block = module->blocks[i];
+
+		blockIndex[block.start] = &block;
+		for (uint16_t j = block.start; j < block.end; ++j) {
+			covered[j] = true;
+		}
+	}
+
+	return true;
+}
+
+bool Aot::isLoaded() const {
+	return module != nullptr;
+}
+
+const AotBlock* Aot::find(uint16_t address) const {
+	if (address >= 4096) {
+		return nullptr;
+	}
+
+	return blockIndex[address];
+}
+
+void Aot::invalidate(uint16_t address) {
+	if (address >= 4096 || !covered[address]) {
+		return;
+	}
+
+	// self modifying code is rare, so all blocks are simply searched
+	for (uint32_t i = 0; i < module->blockCount; ++i) {
+		const AotBlock& block = module->blocks[i];
+
+		if (block.start <= address && address < block.end) {
+			blockIndex[block.start] = nullptr;
+		}
+	}
+
+	covered[address] = false;
+}
+
+void Aot::unload() {
+	module = nullptr;
+
+	for (int i = 0; i < 4096; ++i) {
+		blockIndex[i] = nullptr;
+		covered[i] = false;
+	}
+
+	if (library == nullptr) {
+		return;
+	}
+
+#ifdef _WIN32
+	FreeLibrary(static_cast<HMODULE>(library));
+#else
+	dlclose(library);
+#endif
+
+	library = nullptr;
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "aotPlugin.h"
+
+/* blocks recompiled ahead of time by --recompile (see recompiler.h) and
+loaded from a shared library. Blocks that are overwritten at run time are
+dropped and their code is interpreted from then on*/
+class Aot {
+public:
+	Aot();
+	~Aot();
+
+	Aot(const Aot&) = delete;
+	Aot& operator=(const Aot&) = delete;
+
+	/* loads the plugin at path, fails if it can not be opened or was
+	built from a different program than the one in memory*/
+	bool load(const std::string& path, const uint8_t* memory, std::string& error);
+
+	bool isLoaded() const;
+
+	// returns nullptr if there is no recompiled block starting at address
+	const AotBlock* find(uint16_t address) const;
+
+	// drops every block that covers the byte at address
+	void invalidate(uint16_t address);
+
+private:
+	void* library = nullptr;
+	const AotModule* module = nullptr;
+
+	const AotBlock* blockIndex[4096];
+	bool covered[4096];
+
+	void unload();
+};
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+
+/* the interface between the emulator and a plugin built from the C++
+source written by --recompile. The generated source includes this file,
+so it must not depend on anything else of the emulator*/
+
+#include <cstdint>
+
+// incremented whenever anything in this file changes
+#define CHIP8_AOT_VERSION 2
+
+#ifdef _WIN32
+#define CHIP8_AOT_EXPORT extern "C" __declspec(dllexport)
+#else
+#define CHIP8_AOT_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+// name of the function every plugin exports, see AotModuleFunction
+#define CHIP8_AOT_ENTRY "chip8AotModule"
+
+class Emulator;
+
+// the machine state recompiled blocks work on
+struct AotContext {
+	uint8_t* V = nullptr;
+	uint16_t* I = nullptr;
+	uint16_t* PC = nullptr;
+	uint16_t* SP = nullptr;
+
+	// 16 entries, SP wraps around like addresses wrap at 0xFFF
+	uint16_t* stack = nullptr;
+	uint8_t* DT = nullptr;
+	uint8_t* ST = nullptr;
+	const uint8_t* memory = nullptr;
+
+	Emulator* emulator = nullptr;
+
+	/* executes one instruction that has no C++ translation, PC has to
+	point at the instruction and is advanced by it*/
+	void (*helper)(Emulator*, uint16_t) = nullptr;
+};
+
+struct AotBlock {
+	uint16_t start;
+
+	// address one past the last byte of the block
+	uint16_t end;
+
+	// number of instructions, a block always runs all of them
+	uint32_t length;
+
+	void (*run)(AotContext&);
+};
+
+struct AotModule {
+	uint32_t version;
+
+	// hash of memory from 0x200 to the end when the plugin was generated
+	uint64_t programHash;
+
+	uint32_t blockCount;
+	const AotBlock* blocks;
+};
+
+using AotModuleFunction = const AotModule* (*)();
+
+// FNV-1a of the program area, a plugin only runs on the program it was built from
+inline uint64_t hashProgramMemory(const uint8_t* memory) {
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	for (int i = 512; i < 4096; ++i) {
+		hash ^= memory[i];
+		hash *= 0x100000001B3ull;
+	}
+
+	return hash;
+}
\ No newline at end of file
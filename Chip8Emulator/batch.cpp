@@ -0,0 +1,478 @@
+#include "batch.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+// 64 bit FNV-1a, values are added as little endian bytes so the hash is the same on every host
+class Fnv {
+public:
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	void add(uint64_t value, int bytes) {
+		for (int i = 0; i < bytes; ++i) {
+			hash ^= (value >> (8 * i)) & 0xFF;
+			hash *= 0x100000001B3ull;
+		}
+	}
+};
+
+void addDisplay(Fnv& fnv, const Machine& machine) {
+	for (int i = 0; i < Machine::displayY; ++i) {
+		fnv.add(machine.display[i], 8);
+	}
+}
+
+// everything in Machine but the padding between its members
+uint64_t hashState(const Machine& machine) {
+	Fnv fnv;
+
+	fnv.add(machine.PC, 2);
+	fnv.add(machine.SP, 2);
+	fnv.add(machine.I, 2);
+	fnv.add(machine.DT, 1);
+	fnv.add(machine.ST, 1);
+
+	for (int i = 0; i < 16; ++i) {
+		fnv.add(machine.V[i], 1);
+		fnv.add(machine.keyboard[i], 1);
+	}
+
+	fnv.add(machine.randomState, 8);
+
+	for (int i = 0; i <= Machine::stackMask; ++i) {
+		fnv.add(machine.stack[i], 2);
+	}
+
+	// the padding only mirrors the first bytes
+	for (int i = 0; i < 4096; ++i) {
+		fnv.add(machine.memory[i], 1);
+	}
+
+	addDisplay(fnv, machine);
+
+	return fnv.hash;
+}
+
+uint64_t hashDisplay(const Machine& machine) {
+	Fnv fnv;
+	addDisplay(fnv, machine);
+
+	return fnv.hash;
+}
+
+// true if text is a whole number, in hex with 0x
+bool parseNumber(const std::string& text, uint64_t& value) {
+	if (text.empty() || text[0] == '-') {
+		return false;
+	}
+
+	char* end = nullptr;
+	value = std::strtoull(text.c_str(), &end, 0);
+
+	return *end == '\0';
+}
+
+bool parseMode(const std::string& name, ExecutionMode& mode) {
+	if (name == "interpreter") {
+		mode = ExecutionMode::INTERPRETER;
+	}
+	else if (name == "blocks") {
+		mode = ExecutionMode::BLOCK_CACHE;
+	}
+	else if (name == "jit") {
+		mode = ExecutionMode::JIT;
+	}
+	else if (name == "ir") {
+		mode = ExecutionMode::IR;
+	}
+	else {
+		return false;
+	}
+
+	return true;
+}
+
+// splits line at spaces, a field in double quotes may contain spaces
+bool splitFields(const std::string& line, std::vector<std::string>& fields) {
+	std::string field;
+	bool quoted = false;
+	bool inField = false;
+
+	for (char c : line) {
+		if (c == '"') {
+			quoted = !quoted;
+			inField = true;
+		}
+		else if ((c == ' ' || c == '\t' || c == '\r') && !quoted) {
+			if (inField) {
+				fields.push_back(field);
+				field.clear();
+				inField = false;
+			}
+		}
+		else {
+			field += c;
+			inField = true;
+		}
+	}
+
+	if (inField) {
+		fields.push_back(field);
+	}
+
+	return !quoted;
+}
+
+bool isSkipped(const std::string& line) {
+	size_t first = line.find_first_not_of(" \t\r");
+
+	return first == std::string::npos || line[first] == '#';
+}
+
+bool readFile(const std::string& path, std::vector<uint8_t>& bytes) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+	return !file.bad();
+}
+
+void writeJsonString(std::ostream& out, const std::string& text) {
+	static const char digits[] = "0123456789abcdef";
+
+	out << '"';
+
+	for (char c : text) {
+		unsigned char u = static_cast<unsigned char>(c);
+
+		if (c == '"' || c == '\\') {
+			out << '\\' << c;
+		}
+		else if (u < 0x20) {
+			out << "\\u00" << digits[u >> 4] << digits[u & 0x0F];
+		}
+		else {
+			out << c;
+		}
+	}
+
+	out << '"';
+}
+
+void writeHash(std::ostream& out, uint64_t hash) {
+	static const char digits[] = "0123456789abcdef";
+
+	out << '"';
+	for (int i = 60; i >= 0; i -= 4) {
+		out << digits[(hash >> i) & 0x0F];
+	}
+	out << '"';
+}
+
+}
+
+bool parseManifest(std::istream& in, std::vector<BatchJob>& jobs, std::string& error) {
+	std::string line;
+
+	for (int number = 1; std::getline(in, line); ++number) {
+		if (isSkipped(line)) {
+			continue;
+		}
+
+		std::vector<std::string> fields;
+		if (!splitFields(line, fields)) {
+			error = "line " + std::to_string(number) + ": missing closing quote";
+			return false;
+		}
+
+		BatchJob job;
+		job.line = number;
+
+		for (const std::string& field : fields) {
+			size_t equals = field.find('=');
+			if (equals == std::string::npos) {
+				error = "line " + std::to_string(number) + ": expected key=value instead of " + field;
+				return false;
+			}
+
+			std::string key = field.substr(0, equals);
+			std::string value = field.substr(equals + 1);
+			bool valid = true;
+
+			if (key == "rom") {
+				job.romPath = value;
+			}
+			else if (key == "input") {
+				job.inputPath = value;
+			}
+			else if (key == "cycles") {
+				valid = parseNumber(value, job.cycles);
+			}
+			else if (key == "frames") {
+				valid = parseNumber(value, job.frames);
+			}
+			else if (key == "seed") {
+				valid = parseNumber(value, job.seed);
+			}
+			else if (key == "ipf") {
+				valid = parseNumber(value, job.instructionsPerFrame) && job.instructionsPerFrame != 0;
+			}
+			else if (key == "mode") {
+				valid = parseMode(value, job.executionMode);
+			}
+			else if (key == "quirks") {
+				valid = parseQuirkProfile(value, job.quirkProfile);
+			}
+			else {
+				valid = false;
+			}
+
+			if (!valid) {
+				error = "line " + std::to_string(number) + ": invalid field " + field;
+				return false;
+			}
+		}
+
+		if (job.romPath.empty()) {
+			error = "line " + std::to_string(number) + ": rom is missing";
+			return false;
+		}
+
+		if ((job.cycles == 0) == (job.frames == 0)) {
+			error = "line " + std::to_string(number) + ": needs either cycles or frames";
+			return false;
+		}
+
+		jobs.push_back(job);
+	}
+
+	return true;
+}
+
+bool parseInputScript(std::istream& in, std::vector<InputEvent>& events, std::string& error) {
+	std::string line;
+
+	for (int number = 1; std::getline(in, line); ++number) {
+		if (isSkipped(line)) {
+			continue;
+		}
+
+		std::istringstream fields(line);
+		std::string frame, key, action;
+		InputEvent event;
+
+		fields >> frame >> key >> action;
+
+		bool valid = parseNumber(frame, event.frame) && key.size() == 1 &&
+			std::isxdigit(static_cast<unsigned char>(key[0])) && (action == "down" || action == "up");
+
+		if (!valid) {
+			error = "line " + std::to_string(number) + ": expected \"frame key down|up\"";
+			return false;
+		}
+
+		event.key = static_cast<uint8_t>(std::strtoul(key.c_str(), nullptr, 16));
+		event.pressed = action == "down";
+		events.push_back(event);
+	}
+
+	// events of the same frame keep their order
+	std::stable_sort(events.begin(), events.end(), [](const InputEvent& a, const InputEvent& b) {
+		return a.frame < b.frame;
+	});
+
+	return true;
+}
+
+BatchRun::BatchRun(const BatchJob& job) : job(job) {
+	result.line = job.line;
+	result.romPath = job.romPath;
+	budget = job.cycles != 0 ? job.cycles : job.frames * job.instructionsPerFrame;
+}
+
+BatchRun::~BatchRun() {
+	delete emulator;
+}
+
+bool BatchRun::start() {
+	std::vector<uint8_t> rom;
+	if (!readFile(job.romPath, rom)) {
+		result.error = "could not read the ROM";
+		return false;
+	}
+
+	if (rom.empty() || rom.size() > 4096 - 512) {
+		result.error = "the ROM does not fit into memory";
+		return false;
+	}
+
+	if (!job.inputPath.empty()) {
+		std::ifstream script(job.inputPath);
+		if (!script.is_open()) {
+			result.error = "could not read the input script";
+			return false;
+		}
+
+		if (!parseInputScript(script, events, result.error)) {
+			result.error = "input script " + result.error;
+			return false;
+		}
+	}
+
+	// on the heap, with its caches an emulator is too big for the stack of a worker
+	emulator = new Emulator(rom.data(), static_cast<int>(rom.size()));
+
+	emulator->seedRandom(job.seed);
+	emulator->executionMode = job.executionMode;
+	emulator->setQuirkProfile(job.quirkProfile);
+	emulator->cyclesPerTick = job.instructionsPerFrame;
+
+	return true;
+}
+
+void BatchRun::finish() {
+	result.completed = result.cycles == budget;
+	result.stateHash = hashState(*emulator);
+	result.displayHash = hashDisplay(*emulator);
+
+	delete emulator;
+	emulator = nullptr;
+}
+
+bool BatchRun::runSlice(uint64_t sliceCycles) {
+	if (emulator == nullptr && !start()) {
+		return true;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	uint64_t sliceEnd = budget - result.cycles > sliceCycles ? result.cycles + sliceCycles : budget;
+	bool stopped = false;
+
+	// whole frames only, the input events are applied between them
+	while (result.cycles < sliceEnd) {
+		for (; nextEvent < events.size() && events[nextEvent].frame <= result.frames; ++nextEvent) {
+			const InputEvent& event = events[nextEvent];
+
+			emulator->keyboard[event.key] = event.pressed ? 1 : 0;
+			if (event.pressed) {
+				emulator->keyPressed(event.key);
+			}
+		}
+
+		uint64_t frame = std::min<uint64_t>(job.instructionsPerFrame, budget - result.cycles);
+		uint64_t executed = emulator->runCycles(frame);
+
+		result.cycles += executed;
+
+		if (executed < frame) {
+			stopped = true;
+			break;
+		}
+
+		// a cycle budget may end in the middle of a frame
+		if (frame == job.instructionsPerFrame) {
+			result.frames++;
+		}
+	}
+
+	result.wallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (stopped || result.cycles == budget) {
+		finish();
+		return true;
+	}
+
+	return false;
+}
+
+BatchResult runBatchJob(const BatchJob& job) {
+	BatchRun run(job);
+
+	// the whole budget in one slice
+	run.runSlice(UINT64_MAX);
+
+	return run.result;
+}
+
+void writeResultJson(std::ostream& out, const BatchResult& result) {
+	out << "{\"line\":" << result.line << ",\"rom\":";
+	writeJsonString(out, result.romPath);
+
+	if (!result.error.empty()) {
+		out << ",\"status\":\"error\",\"error\":";
+		writeJsonString(out, result.error);
+		out << '}';
+		return;
+	}
+
+	out << ",\"status\":" << (result.completed ? "\"ok\"" : "\"stopped\"");
+	out << ",\"state_hash\":";
+	writeHash(out, result.stateHash);
+	out << ",\"framebuffer_hash\":";
+	writeHash(out, result.displayHash);
+	out << ",\"cycles\":" << result.cycles << ",\"frames\":" << result.frames;
+	out << ",\"wall_ms\":" << result.wallSeconds * 1000 << '}';
+}
+
+int runBatch(const std::vector<BatchJob>& jobs, unsigned threads, uint64_t sliceCycles,
+	std::ostream& out, std::vector<WorkerStats>* stats) {
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, jobs.size())));
+
+	std::vector<BatchRun*> runs;
+	for (const BatchJob& job : jobs) {
+		runs.push_back(new BatchRun(job));
+	}
+
+	std::atomic<int> failed{ 0 };
+	std::mutex outMutex;
+
+	WorkStealingScheduler scheduler(threads);
+
+	scheduler.run(runs.size(), [&](size_t i) {
+		if (!runs[i]->runSlice(sliceCycles)) {
+			return false;
+		}
+
+		if (!runs[i]->result.error.empty()) {
+			failed++;
+		}
+
+		std::lock_guard<std::mutex> lock(outMutex);
+		writeResultJson(out, runs[i]->result);
+		out << '\n';
+		out.flush();
+
+		return true;
+	});
+
+	for (BatchRun* run : runs) {
+		delete run;
+	}
+
+	if (stats != nullptr) {
+		*stats = scheduler.stats;
+	}
+
+	return failed;
+}
+
+void writeWorkerStatsJson(std::ostream& out, unsigned worker, const WorkerStats& stats) {
+	out << "{\"worker\":" << worker << ",\"slices\":" << stats.slices << ",\"steals\":" << stats.steals;
+	out << ",\"busy_ms\":" << stats.busySeconds * 1000 << ",\"wall_ms\":" << stats.wallSeconds * 1000;
+	out << ",\"utilization\":" << stats.utilization() << '}';
+}
\ No newline at end of file
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ostream>
+#include "emulator.h"
+#include "scheduler.h"
+
+// a key that is pressed or released at the start of a frame
+struct InputEvent {
+	uint64_t frame;
+	uint8_t key;
+	bool pressed;
+};
+
+/* one line of a manifest, everything chip8-batch needs to run a ROM without
+a window. The budget is either instructions (cycles) or 60Hz frames*/
+struct BatchJob {
+	// the line of the manifest, used in the output to tell jobs apart
+	int line = 0;
+
+	std::string romPath;
+	uint64_t cycles = 0;
+	uint64_t frames = 0;
+	uint64_t seed = 0;
+
+	// empty if no keys are pressed
+	std::string inputPath;
+
+	// instructions per frame, the timers tick once every frame
+	uint64_t instructionsPerFrame = 10;
+
+	ExecutionMode executionMode = ExecutionMode::INTERPRETER;
+	QuirkProfile quirkProfile = QuirkProfile::MODERN;
+};
+
+struct BatchResult {
+	int line = 0;
+	std::string romPath;
+
+	// empty if the job could run, otherwise why it could not
+	std::string error;
+
+	// false if the ROM stopped on an unknown opcode before the budget ran out
+	bool completed = false;
+
+	uint64_t cycles = 0;
+	uint64_t frames = 0;
+
+	// FNV-1a of the registers, stack, memory and display, and of the display alone
+	uint64_t stateHash = 0;
+	uint64_t displayHash = 0;
+
+	double wallSeconds = 0;
+};
+
+/* reads a manifest with one job per line, blank lines and lines starting with
+# are skipped. A job is a list of key=value fields separated by spaces, values
+with spaces can be put in double quotes:
+
+	rom=games/pong.ch8 frames=600 seed=42 input=pong.keys
+	rom="roms/a b.ch8" cycles=1000000 mode=blocks quirks=cosmac
+
+rom and one of cycles or frames are required. The optional fields are seed
+(default 0), input, ipf (instructions per frame, default 10), mode
+(interpreter, blocks, jit or ir) and quirks (modern, cosmac or schip).
+Returns false and sets error at the first line that can not be parsed*/
+bool parseManifest(std::istream& in, std::vector<BatchJob>& jobs, std::string& error);
+
+/* reads an input script, one event per line in the form "frame key down|up"
+with the key as a hex digit, e.g. "120 5 down". Events can be in any order,
+blank lines and lines starting with # are skipped*/
+bool parseInputScript(std::istream& in, std::vector<InputEvent>& events, std::string& error);
+
+/* a job that runs a slice at a time, so a scheduler can move it between
+threads. The ROM is only loaded and the emulator only exists from the first
+slice until the job is done*/
+class BatchRun {
+public:
+	explicit BatchRun(const BatchJob& job);
+	~BatchRun();
+
+	BatchRun(const BatchRun&) = delete;
+	BatchRun& operator=(const BatchRun&) = delete;
+
+	/* runs sliceCycles instructions rounded up to whole frames, or less if
+	the budget ends first. Returns true once the job is done and result is
+	complete*/
+	bool runSlice(uint64_t sliceCycles);
+
+	// wallSeconds only counts the time spent in runSlice
+	BatchResult result;
+
+private:
+	const BatchJob& job;
+	Emulator* emulator = nullptr;
+	uint64_t budget = 0;
+
+	std::vector<InputEvent> events;
+	size_t nextEvent = 0;
+
+	// loads the ROM and the input script, false if the job can not run
+	bool start();
+	void finish();
+};
+
+/* runs job on an emulator of its own, the timers follow the instruction
+count so the result only depends on the job and never on the host*/
+BatchResult runBatchJob(const BatchJob& job);
+
+// result as one line of JSON, without the newline
+void writeResultJson(std::ostream& out, const BatchResult& result);
+
+/* runs every job on threads workers (the number of cores if 0) with a
+WorkStealingScheduler, a job is run sliceCycles instructions at a time. Each
+result is written to out as a JSON line as soon as it is done, so the lines
+are in the order the jobs finish. stats gets what each worker did if it is
+not nullptr. Returns the number of jobs that failed*/
+int runBatch(const std::vector<BatchJob>& jobs, unsigned threads, uint64_t sliceCycles,
+	std::ostream& out, std::vector<WorkerStats>* stats);
+
+// stats of worker as one line of JSON, without the newline
+void writeWorkerStatsJson(std::ostream& out, unsigned worker, const WorkerStats& stats);
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "batch.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+
+/* chip8-batch, runs every job of a manifest (see parseManifest) without a
+window and prints one JSON line per job to stdout:
+
+	chip8-batch manifest.txt [--threads n] [--slice cycles]
+
+jobs are run in slices of --slice instructions (1000000 by default) and
+move between the threads as they finish at different times. One JSON line
+per thread with its utilization is written to stderr at the end. The exit
+code is 1 if any job could not be run*/
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "usage: chip8-batch manifest [--threads n] [--slice cycles]" << std::endl;
+		return 2;
+	}
+
+	unsigned threads = 0;
+	uint64_t sliceCycles = 1000000;
+
+	for (int i = 2; i < argc; ++i) {
+		std::string option = argv[i];
+
+		if (option == "--threads" && i + 1 < argc) {
+			int count = std::atoi(argv[++i]);
+			if (count <= 0) {
+				std::cerr << "Error: --threads needs a positive number" << std::endl;
+				return 2;
+			}
+			threads = static_cast<unsigned>(count);
+		}
+		else if (option == "--slice" && i + 1 < argc) {
+			sliceCycles = std::strtoull(argv[++i], nullptr, 0);
+			if (sliceCycles == 0) {
+				std::cerr << "Error: --slice needs a positive number" << std::endl;
+				return 2;
+			}
+		}
+		else {
+			std::cerr << "Unknown option: " << option << std::endl;
+			return 2;
+		}
+	}
+
+	std::ifstream manifest(argv[1]);
+	if (!manifest.is_open()) {
+		std::cerr << "Error: Could not open file: " << argv[1] << std::endl;
+		return 2;
+	}
+
+	std::vector<BatchJob> jobs;
+	std::string error;
+
+	if (!parseManifest(manifest, jobs, error)) {
+		std::cerr << "Error: " << argv[1] << " " << error << std::endl;
+		return 2;
+	}
+
+	std::vector<WorkerStats> stats;
+	int failed = runBatch(jobs, threads, sliceCycles, std::cout, &stats);
+
+	for (size_t i = 0; i < stats.size(); ++i) {
+		writeWorkerStatsJson(std::cerr, static_cast<unsigned>(i), stats[i]);
+		std::cerr << std::endl;
+	}
+
+	return failed == 0 ? 0 : 1;
+}
\ No newline at end of file
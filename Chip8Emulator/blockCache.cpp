@@ -0,0 +1,64 @@
+#include "blockCache.h"
+
+BlockCache::BlockCache() {
+	for (int i = 0; i < 4096; ++i) {
+		coverage[i] = 0;
+	}
+}
+
+Block* BlockCache::find(uint16_t address) {
+	if (address >= 4096) {
+		return nullptr;
+	}
+
+	return blocks[address].get();
+}
+
+Block* BlockCache::insert(std::unique_ptr<Block> block) {
+	uint16_t start = block->start;
+
+	if (blocks[start]) {
+		remove(start);
+	}
+
+	for (uint16_t i = block->start; i < block->end; ++i) {
+		coverage[i]++;
+	}
+
+	blocks[start] = std::move(block);
+
+	return blocks[start].get();
+}
+
+void BlockCache::invalidate(uint16_t address) {
+	if (address >= 4096 || coverage[address] == 0) {
+		return;
+	}
+
+	// only blocks starting at most one block length before can cover address
+	int first = address - 2 * maxBlockLength;
+	if (first < 0) {
+		first = 0;
+	}
+
+	for (int start = first; start <= address; ++start) {
+		if (blocks[start] && blocks[start]->end > address) {
+			remove(static_cast<uint16_t>(start));
+		}
+	}
+}
+
+void BlockCache::clear() {
+	for (int i = 0; i < 4096; ++i) {
+		blocks[i].reset();
+		coverage[i] = 0;
+	}
+}
+
+void BlockCache::remove(uint16_t start) {
+	for (uint16_t i = blocks[start]->start; i < blocks[start]->end; ++i) {
+		coverage[i]--;
+	}
+
+	blocks[start].reset();
+}
\ No newline at end of file
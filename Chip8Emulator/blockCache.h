@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "instruction.h"
+#include "ir.h"
+
+class Emulator;
+
+// an instruction of a block together with the handler that executes it
+struct CompiledInstruction {
+	void (*handler)(Emulator&, const Instruction&);
+	Instruction in;
+};
+
+/* a straight line run of instructions, only the last one can change
+the control flow (jumps, calls, returns, skips and Fx0A) or write to
+memory (Fx33 and Fx55)*/
+struct Block {
+	uint16_t start = 0;
+
+	// address one past the last byte of the block
+	uint16_t end = 0;
+
+	std::vector<CompiledInstruction> instructions;
+
+	// the block lifted by liftBlock, filled in when ExecutionMode::IR first runs it
+	std::vector<IrInstruction> ir;
+};
+
+/* blocks keyed by the address of their first instruction. Every byte
+remembers how many blocks cover it so that writes to memory that is not
+code are cheap to ignore*/
+class BlockCache {
+public:
+	// longest block that will be compiled, in instructions
+	static const int maxBlockLength = 64;
+
+	BlockCache();
+
+	// returns nullptr if there is no block starting at address
+	Block* find(uint16_t address);
+
+	Block* insert(std::unique_ptr<Block> block);
+
+	// drops every block that covers the byte at address
+	void invalidate(uint16_t address);
+
+	void clear();
+
+private:
+	std::unique_ptr<Block> blocks[4096];
+	uint16_t coverage[4096];
+
+	void remove(uint16_t start);
+};
\ No newline at end of file
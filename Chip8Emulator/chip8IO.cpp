@@ -1,11 +1,18 @@
 #include "chip8IO.h"
+
+/* when SLOW_EXECUTION is defined one instruction will be processed
+ only after a key (0-9 or a-f) is pressed*/
+//#define SLOW_EXECUTION
+/* when FAST_EXECUTION is defined the frames are run back to back without
+ sleeping, so the program runs as fast as the host allows*/
+//#define FAST_EXECUTION
     
-Chip8IO::Chip8IO(uint8_t ** display, uint8_t* keyboard, uint8_t& soundTimer, std::function<void(uint8_t)> func) :
+Chip8IO::Chip8IO(uint64_t* display, uint8_t* keyboard, uint8_t& soundTimer, std::function<void(uint8_t)> func) :
         display(display), keyboard(keyboard), func(func), soundTimer(soundTimer) {}
 
 std::function<void(uint8_t)> func;
 
-uint8_t** display;
+uint64_t* display;
 uint8_t* keyboard;
     
 
@@ -75,10 +82,15 @@ void Chip8IO::startIO() {
             else if (event.type == sf::Event::KeyPressed || event.type == sf::Event::KeyReleased) {
                 int key = mapKeyCodes(event.key.code);
 
+                // keys that are not mapped would write past keyboard into the machine state
+                if (key == -1) {
+                    continue;
+                }
+
                 if (event.type == sf::Event::KeyReleased) {
                     keyboard[key] = 0;
                 }
-                else if (key != -1 && keyboard[key] == 0) {
+                else if (keyboard[key] == 0) {
                     keyboard[key] = 1;
                     func(key);
                 }
@@ -93,7 +105,7 @@ void Chip8IO::startIO() {
 
         for (int i = 0; i < 64; ++i) {
             for (int j = 0; j < 32; ++j) {
-                if (display[i][j] == 1) {
+                if (((display[j] >> (63 - i)) & 1) == 1) {
                     rectangle.setPosition(sf::Vector2f(i * size.x / 64.0f, j * size.y / 32.0f));
                     window.draw(rectangle);
                 }
@@ -102,4 +114,88 @@ void Chip8IO::startIO() {
             
         window.display();
     }
+}
+
+void startEmulator(Emulator& emulator) {
+#ifdef SLOW_EXECUTION
+    std::atomic<bool> newKeyPressed{ false };
+#endif
+
+    auto func = [&](uint8_t key) {
+#ifdef SLOW_EXECUTION
+        newKeyPressed = true;
+#endif
+        emulator.keyPressed(key);
+        };
+
+    Chip8IO io(emulator.display, emulator.keyboard, emulator.ST, func);
+
+    // handeling all the IO operations in a separate thread
+    std::thread ioThread([&]() {
+        io.startIO();
+
+        // closing the window stops the emulator
+        emulator.stop();
+    });
+
+#ifdef SLOW_EXECUTION
+    // timer used for delay timer and sound timer registers
+    sf::Clock timer;
+#endif
+
+#ifndef SLOW_EXECUTION
+    // length of one 60Hz frame
+    const std::chrono::microseconds frameDuration(16667);
+#endif
+
+#if !defined(SLOW_EXECUTION) && !defined(FAST_EXECUTION)
+    // the frames are dropped instead of catching up when falling further behind than this
+    const std::chrono::microseconds maxLag = 5 * frameDuration;
+
+    auto nextFrame = std::chrono::steady_clock::now();
+#endif
+
+    while (emulator.isRunning()) {
+#ifdef SLOW_EXECUTION
+        emulator.step();
+
+        if (timer.getElapsedTime().asMicroseconds() > 16667) {
+            emulator.tickTimers();
+
+            timer.restart();
+        }
+
+        newKeyPressed = false;
+        while (!newKeyPressed) {}
+#else
+        // instructionsPerFrame instructions in one burst, then the timers tick once
+        emulator.runFrame();
+
+#ifndef FAST_EXECUTION
+        /* the deadline advances by exactly one frame so that the time spent
+        running the frame and oversleeping does not add up over time*/
+        nextFrame += frameDuration;
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (now - nextFrame > maxLag) {
+            nextFrame = now;
+        }
+        else if (emulator.isWaitingForKey()) {
+            // Fx0A, a key press ends the wait early, otherwise the timers tick as usual
+            emulator.waitForKey(nextFrame);
+        }
+        else {
+            std::this_thread::sleep_until(nextFrame);
+        }
+#else
+        // frames run back to back, but Fx0A still does not need to spin
+        if (emulator.isWaitingForKey()) {
+            emulator.waitForKey(std::chrono::steady_clock::now() + frameDuration);
+        }
+#endif
+#endif
+    }
+
+    ioThread.join();
 }
\ No newline at end of file
@@ -4,20 +4,30 @@
 #include <SFML/Audio.hpp>
 #include <unordered_map>
 #include <functional>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include "emulator.h"
 
 class Chip8IO {
 public:
-    /* Everything on the 2d display array is displayed on the screen,
+    /* Everything on the display rows (see Machine::display) is displayed on the screen,
     all the buttons that are pressed are made = 1 in the 1d keyboard array,
     whenever a new key is pressed func function is called with the keycode of the
     key pressed*/
-    Chip8IO(uint8_t** display, uint8_t* keyboard, uint8_t &soundTimer, std::function<void(uint8_t)> func);
+    Chip8IO(uint64_t* display, uint8_t* keyboard, uint8_t &soundTimer, std::function<void(uint8_t)> func);
 
     std::function<void(uint8_t)> func;
-    uint8_t** display;
+    uint64_t* display;
     uint8_t* keyboard;
     uint8_t& soundTimer;
 
     int mapKeyCodes(sf::Keyboard::Key keyCode);
     void startIO();
 };
+
+/* runs the emulator with a window, the window is handled by Chip8IO on a
+separate thread while the emulator core runs on the calling thread. Every
+60Hz frame runs emulator.instructionsPerFrame instructions and then sleeps
+until the next frame is due. returns when the emulator is stopped*/
+void startEmulator(Emulator& emulator);
\ No newline at end of file
@@ -1,559 +1,1580 @@
 #include "emulator.h"
-#include "chip8IO.h"
+#include <cstring>
 
 //#define PRINT_INSTRUCTION
 //#define PRINT_SPRITE
-/* when SLOW_EXECUTION is defined one instruction will be processed
- only after a key (0-9 or a-f) is pressed*/
-//#define SLOW_EXECUTION
-/* when FAST_EXECUTION is defined there is minimum amount of delay
- between the processing of two instructions*/
-//#define FAST_EXECUTION
 //#define PRINT_REGISTERS
+/* when THREADED_DISPATCH is defined every instruction handler jumps
+ directly to the next one using computed goto (GCC and Clang only),
+ otherwise a single switch is used for dispatching*/
+//#define THREADED_DISPATCH
+/* when TABLE_DISPATCH is defined the handler of every opcode is looked up
+ in a table with an entry for each of the 65536 possible opcodes*/
+//#define TABLE_DISPATCH
+/* when LAZY_FLAGS is defined 8xy4, 8xy5, 8xy6, 8xy7 and 8xyE only remember
+ their operands and the interpreter writes VF once something uses it*/
+//#define LAZY_FLAGS
+/* when DEFERRED_DRAWING is defined Dxyn only adds the sprite to a list that
+ is drawn when the display or VF is needed, or when the interpreter returns*/
+//#define DEFERRED_DRAWING
+
+// VF is written after the instruction that sets it
+#if defined(LAZY_FLAGS) || defined(DEFERRED_DRAWING)
+#define CHIP8_DEFERRED_VF 1
+#else
+#define CHIP8_DEFERRED_VF 0
+#endif
+
+#if defined(THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define CHIP8_THREADED_DISPATCH 1
+#else
+#define CHIP8_THREADED_DISPATCH 0
+#endif
 
 
 Emulator::Emulator(const uint8_t* program, int programLength) {
-	// allocating 4kb of memory for the program to run
-	memory = new uint8_t[4096];
+	// memory, registers, display and keyboard start out zeroed by Machine
+	loadProgram(*this, program, programLength);
+
+	// Cxkk is only reproducible when seedRandom is called with a fixed seed
+	std::random_device rd;
+	seedRandom((static_cast<uint64_t>(rd()) << 32) | rd());
+
+	// one entry for every two bytes of memory, filled in lazily by fetch
+	decodeCache = new Instruction[2048];
+
+	// the registers compiled code works on
+	jitContext.V = V;
+	jitContext.I = &I;
+	jitContext.PC = &PC;
+	jitContext.DT = &DT;
+	jitContext.ST = &ST;
+	jitContext.emulator = this;
+	jitContext.helper = &runJitInstruction;
+
+	aotContext.V = V;
+	aotContext.I = &I;
+	aotContext.PC = &PC;
+	aotContext.SP = &SP;
+	aotContext.stack = stack;
+	aotContext.DT = &DT;
+	aotContext.ST = &ST;
+	aotContext.memory = memory;
+	aotContext.emulator = this;
+	aotContext.helper = &runAotInstruction;
+
+#ifdef PRINT_INSTRUCTION
+	std::cout << "Location | Instruction" << std::endl;
+#endif
+}
+
+template <>
+inline void Emulator::execute<Op::CLS>(const Instruction&) {
+	// 00E0 - CLS
+#ifdef DEFERRED_DRAWING
+	// the collision of a sprite that is still in the list may be read later
+	flushDraws();
+#endif
+
+	for (int i = 0; i < displayY; ++i) {
+		display[i] = 0;
+	}
+
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::RET>(const Instruction&) {
+	// 00EE - RET
+	PC = stack[SP];
+	// 2 is added to the program counter so as not to call again
+	PC += 2;
+	SP = (SP - 1) & stackMask;
+}
+
+template <>
+inline void Emulator::execute<Op::JP>(const Instruction& in) {
+	// 1nnn - JP addr
+	PC = in.nnn;
+}
+
+template <>
+inline void Emulator::execute<Op::CALL>(const Instruction& in) {
+	// 2nnn - CALL addr
+	SP = (SP + 1) & stackMask;
+	stack[SP] = PC;
+
+	PC = in.nnn;
+}
+
+template <>
+inline void Emulator::execute<Op::SE_BYTE>(const Instruction& in) {
+	// 3xkk - SE Vx, byte
+	if (V[in.x] == in.kk) {
+		// we increment by 4 instead of 2 as one instruction is two 
+		// bytes long
+		PC += 4;
+	}
+	else {
+		PC += 2;
+	}
+}
+
+template <>
+inline void Emulator::execute<Op::SNE_BYTE>(const Instruction& in) {
+	// 4xkk - SNE Vx, byte
+	if (V[in.x] != in.kk) {
+		PC += 4;
+	}
+	else {
+		PC += 2;
+	}
+}
+
+template <>
+inline void Emulator::execute<Op::SE_REG>(const Instruction& in) {
+	// 5xy0 - SE Vx, Vy
+	if (V[in.x] == V[in.y]) {
+		PC += 4;
+	}
+	else {
+		PC += 2;
+	}
+}
+
+template <>
+inline void Emulator::execute<Op::LD_BYTE>(const Instruction& in) {
+	// 6xkk - LD Vx, byte
+	V[in.x] = in.kk;
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::ADD_BYTE>(const Instruction& in) {
+	// 7xkk - ADD Vx, byte
+	V[in.x] += in.kk;
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::LD_REG>(const Instruction& in) {
+	// 8xy0 - LD Vx, Vy
+	V[in.x] = V[in.y];
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::OR>(const Instruction& in) {
+	// 8xy1 - OR Vx, Vy
+	V[in.x] |= V[in.y];
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::AND>(const Instruction& in) {
+	// 8xy2 - AND Vx, Vy
+	V[in.x] &= V[in.y];
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::XOR>(const Instruction& in) {
+	// 8xy3 - XOR Vx, Vy
+	V[in.x] ^= V[in.y];
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::ADD_REG>(const Instruction& in) {
+	// 8xy4 - ADD Vx, Vy
+	uint16_t sum = static_cast<uint16_t>(V[in.x]) + static_cast<uint16_t>(V[in.y]);
+
+	if ((sum & 0xFF00) == 0) {
+		V[15] = 0;
+	}
+	else {
+		V[15] = 1;
+	}
+
+	V[in.x] = static_cast<uint8_t>(sum & 0x00FF);
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::SUB>(const Instruction& in) {
+	// 8xy5 - SUB Vx, Vy
+	if (V[in.x] >= V[in.y]) {
+		V[15] = 1;
+	}
+	else {
+		V[15] = 0;
+	}
+
+	V[in.x] -= V[in.y];
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::SHR>(const Instruction& in) {
+	// 8xy6 - SHR Vx {, Vy}
+	if ((V[in.x] & 0x01) == 1) {
+		V[15] = 1;
+	}
+	else {
+		V[15] = 0;
+	}
+
+	// ik the compiler optimizes division like this but still ...
+	V[in.x] >>= 1;
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::SUBN>(const Instruction& in) {
+	// 8xy7 - SUBN Vx, Vy
+	if (V[in.x] >= V[in.y]) {
+		V[15] = 0;
+	}
+	else {
+		V[15] = 1;
+	}
+
+	V[in.x] = V[in.y] - V[in.x];
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::SHL>(const Instruction& in) {
+	// 8xyE - SHL Vx {, Vy}
+	if ((V[in.x] & 0x80) != 0) {
+		V[15] = 1;
+	}
+	else {
+		V[15] = 0;
+	}
+
+	// ik the compiler optimizes division like this but still ...
+	V[in.x] <<= 1;
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::SNE_REG>(const Instruction& in) {
+	// 9xy0 - SNE Vx, Vy
+	if (V[in.x] != V[in.y]) {
+		PC += 4;
+	}
+	else {
+		PC += 2;
+	}
+}
+
+template <>
+inline void Emulator::execute<Op::LD_I>(const Instruction& in) {
+	// Annn - LD I, addr
+	I = in.nnn;
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::JP_V0>(const Instruction& in) {
+	// Bnnn - JP V0, addr
+	PC = in.nnn + V[0];
+}
+
+template <>
+inline void Emulator::execute<Op::RND>(const Instruction& in) {
+	// Cxkk - RND Vx, byte
+	V[in.x] = in.kk & nextRandom();
+
+	PC += 2;
+}
+
+template <bool clip>
+inline void Emulator::drawSprite(const Instruction& in) {
+	// the position is read before VF is cleared, in case Vx or Vy is VF
+	int x = V[in.x] % displayX, y = V[in.y] % displayY;
+
+	V[15] = 0;
+	#ifdef PRINT_SPRITE
+	std::cout << "Drawing sprite at " << static_cast<int>(V[in.x]) << ", " 
+		<< static_cast<int>(V[in.y]) << std::endl;
+	#endif
+
+	// the padding after memory makes the sprite wrap past 0xFFF
+	if (blitSprite(display, memory + (I & addressMask), in.n, x, y, !clip) != 0) {
+		V[15] = 1;
+	}
+
+	#ifdef PRINT_SPRITE
+	for (uint16_t i = 0; i < in.n; ++i) {
+		int row = (y + i) % displayY;
+
+		std::cout << toHex((static_cast<uint16_t>(memory[(i + I) & addressMask]) & 0x00F0) >> 4) <<
+			toHex(static_cast<uint16_t>(memory[(i + I) & addressMask]) & 0x000F) << std::endl;
+
+		for (int j = 0; j < 8; ++j) {
+			if (((display[row] << ((x + j) % displayX)) >> 63) == 1) {
+				std::cout << "& ";
+			}
+			else {
+				std::cout << ". ";
+			}
+		}
+		std::cout << std::endl;
+	}
+	#endif
+}
+
+inline void Emulator::deferSprite(const Instruction& in, bool wrap) {
+	if (deferredDrawCount == maxDeferredDraws) {
+		flushDraws();
+	}
+
+	DeferredDraw& draw = deferredDraws[deferredDrawCount++];
+	draw.x = V[in.x] % displayX;
+	draw.y = V[in.y] % displayY;
+	draw.n = in.n;
+	draw.wrap = wrap;
+
+	// memory may change before the sprite is drawn, the padding makes a whole copy safe
+	std::memcpy(draw.sprite, memory + (I & addressMask), sizeof(draw.sprite));
+
+	// VF is the collision of this sprite, any earlier flag has been overwritten
+	flagOp = Op::DRW;
+}
+
+template <>
+inline void Emulator::execute<Op::DRW>(const Instruction& in) {
+	// Dxyn - DRW Vx, Vy, nibble
+	drawSprite<false>(in);
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::SKP>(const Instruction& in) {
+	// Ex9E - SKP Vx, only the low 4 bits of Vx name a key so the read stays in keyboard
+	if (keyboard[V[in.x] & 0x0F] == 1) {
+		PC += 4;
+	}
+	else {
+		PC += 2;
+	}
+}
+
+template <>
+inline void Emulator::execute<Op::SKNP>(const Instruction& in) {
+	// ExA1 - SKNP Vx, the key is masked like in SKP
+	if (keyboard[V[in.x] & 0x0F] != 1) {
+		PC += 4;
+	}
+	else {
+		PC += 2;
+	}
+}
+
+template <>
+inline void Emulator::execute<Op::LD_VX_DT>(const Instruction& in) {
+	// Fx07 - LD Vx, DT
+	V[in.x] = DT;
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::LD_VX_K>(const Instruction& in) {
+	// Fx0A - LD Vx, K
+	std::lock_guard<std::mutex> lock(keyMutex);
+
+	// only keys pressed after this instruction started count
+	if (!waitingForKey) {
+		waitingForKey = true;
+		pendingKeys.clear();
+	}
+
+	// PC is not incremented so this instruction runs again next cycle
+	if (pendingKeys.empty()) {
+		return;
+	}
+
+	waitingForKey = false;
+	V[in.x] = pendingKeys.front();
+	pendingKeys.pop_front();
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::LD_DT_VX>(const Instruction& in) {
+	// Fx15 - LD DT, Vx
+	DT = V[in.x];
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::LD_ST_VX>(const Instruction& in) {
+	// Fx18 - LD ST, Vx
+	ST = V[in.x];
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::ADD_I_VX>(const Instruction& in) {
+	// Fx1E - ADD I, Vx
+	I += V[in.x];
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::LD_F_VX>(const Instruction& in) {
+	// Fx29 - LD F, Vx
+	I = 5 * V[in.x];
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::LD_B_VX>(const Instruction& in) {
+	// Fx33 - LD B, Vx
+	uint8_t value = V[in.x];
+
+	writeMemory(I, value / 100);
+	writeMemory(I + 1, (value % 100) / 10);
+	writeMemory(I + 2, value % 10);
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::LD_I_VX>(const Instruction& in) {
+	// Fx55 - LD [I], Vx
+	for (int i = 0; i <= in.x; ++i) {
+		writeMemory(I + i, V[i]);
+	}
+	PC += 2;
+}
+
+template <>
+inline void Emulator::execute<Op::LD_VX_I>(const Instruction& in) {
+	// Fx65 - LD Vx, [I]
+	for (int i = 0; i <= in.x; ++i) {
+		V[i] = memory[(I + i) & addressMask];
+	}
+	PC += 2;
+}
+
+template <class Quirks, Op op>
+inline void Emulator::executeWith(const Instruction& in) {
+#ifdef LAZY_FLAGS
+	if constexpr (producesFlag(op)) {
+		// the flag can only be left for later when VF is not an operand
+		if (in.x != 15 && in.y != 15) {
+			flagOp = op;
+			flagX = V[in.x];
+			flagY = V[in.y];
+
+			if constexpr ((op == Op::SHR || op == Op::SHL) && Quirks::shiftVy) {
+				flagX = flagY;
+			}
+
+			if constexpr (op == Op::ADD_REG) {
+				V[in.x] = flagX + flagY;
+			}
+			else if constexpr (op == Op::SUB) {
+				V[in.x] = flagX - flagY;
+			}
+			else if constexpr (op == Op::SUBN) {
+				V[in.x] = flagY - flagX;
+			}
+			else if constexpr (op == Op::SHR) {
+				V[in.x] = flagX >> 1;
+			}
+			else {
+				V[in.x] = flagX << 1;
+			}
+
+			PC += 2;
+			return;
+		}
+	}
+
+#endif
+
+#ifdef DEFERRED_DRAWING
+	if constexpr (op == Op::DRW) {
+		// Vx and Vy are only read now if neither of them is VF
+		if (in.x != 15 && in.y != 15) {
+			deferSprite(in, !Quirks::clipSprites);
+			PC += 2;
+			return;
+		}
+
+		// the sprites in the list come first, or the collision would be wrong
+		flushDraws();
+	}
+#endif
+
+#if CHIP8_DEFERRED_VF
+	/* x and y are checked even for instructions that do not use them as
+	registers, writing VF too early is still correct*/
+	constexpr bool writesVF = op == Op::DRW || producesFlag(op) ||
+		(Quirks::resetVF && (op == Op::OR || op == Op::AND || op == Op::XOR));
+
+	if (flagOp != Op::UNKNOWN && (writesVF || in.x == 15 || in.y == 15)) {
+		writeFlag();
+	}
+#endif
+
+	if constexpr (op == Op::OR || op == Op::AND || op == Op::XOR) {
+		execute<op>(in);
+
+		if constexpr (Quirks::resetVF) {
+			V[15] = 0;
+		}
+	}
+	else if constexpr (op == Op::SHR || op == Op::SHL) {
+		// Vx = Vy >> 1 is the same as copying Vy and then shifting Vx
+		if constexpr (Quirks::shiftVy) {
+			V[in.x] = V[in.y];
+		}
+
+		execute<op>(in);
+	}
+	else if constexpr (op == Op::LD_I_VX || op == Op::LD_VX_I) {
+		uint8_t x = in.x;
+
+		execute<op>(in);
+
+		if constexpr (Quirks::incrementI) {
+			I += x + 1;
+		}
+	}
+	else if constexpr (op == Op::JP_V0 && Quirks::jumpVx) {
+		// Bxnn - JP Vx, xnn
+		PC = in.nnn + V[in.x];
+	}
+	else if constexpr (op == Op::DRW && Quirks::clipSprites) {
+		drawSprite<true>(in);
+		PC += 2;
+	}
+	else {
+		execute<op>(in);
+	}
+}
+
+template <class Quirks, Op op>
+inline uint64_t Emulator::executeFused(const Instruction& in) {
+	if constexpr (op == Op::LD_LD_DRW) {
+		// 6xkk, 6ykk, Dxyn - setting up the position of a sprite and drawing it
+		executeWith<Quirks, Op::LD_BYTE>(in);
+		executeWith<Quirks, Op::LD_BYTE>((&in)[1]);
+		executeWith<Quirks, Op::DRW>((&in)[2]);
+
+		return 3;
+	}
+	else if constexpr (op == Op::LD_I_DRW) {
+		// Annn, Dxyn
+		executeWith<Quirks, Op::LD_I>(in);
+		executeWith<Quirks, Op::DRW>((&in)[1]);
+
+		return 2;
+	}
+	else {
+		/* 7xkk, 3xkk, 1nnn - a counted loop (ADD_SE_JP)
+		Fx07, 3xkk, 1nnn - waiting for the delay timer (DT_SE_JP)*/
+		uint16_t jump = PC + 4;
+
+		if constexpr (op == Op::ADD_SE_JP) {
+			executeWith<Quirks, Op::ADD_BYTE>(in);
+		}
+		else {
+			executeWith<Quirks, Op::LD_VX_DT>(in);
+		}
+
+		executeWith<Quirks, Op::SE_BYTE>((&in)[1]);
+
+		// the loop has finished and the jump is skipped
+		if (PC != jump) {
+			return 2;
+		}
+
+		executeWith<Quirks, Op::JP>((&in)[2]);
+
+		return 3;
+	}
+}
+
+template <class Quirks, Op op>
+bool Emulator::handleOpcode(Emulator& emulator, uint16_t opcode) {
+	emulator.executeWith<Quirks, op>(decodeOperands(opcode));
+
+	return true;
+}
+
+bool Emulator::handleUnknownOpcode(Emulator& emulator, uint16_t) {
+	emulator.unknownOpcode();
+
+	return false;
+}
+
+template <class Quirks>
+constexpr std::array<Emulator::OpcodeHandler, 0x10000> Emulator::makeOpcodeHandlers() {
+	// handler of every instruction in the same order as Op
+	constexpr OpcodeHandler handlersByOp[] = {
+		&handleUnknownOpcode,
+#define CHIP8_OP_HANDLER(name, opcode) &handleOpcode<Quirks, Op::name>,
+		CHIP8_OPS(CHIP8_OP_HANDLER)
+#undef CHIP8_OP_HANDLER
+	};
+
+	std::array<OpcodeHandler, 0x10000> handlers{};
+
+	for (uint32_t opcode = 0; opcode < 0x10000; ++opcode) {
+		handlers[opcode] = handlersByOp[static_cast<int>(opcodeTable[opcode])];
+	}
+
+	return handlers;
+}
+
+template <Op op>
+void Emulator::runInstruction(Emulator& emulator, const Instruction& in) {
+	emulator.execute<op>(in);
+}
+
+const Emulator::InstructionHandler Emulator::instructionHandlers[] = {
+	nullptr,
+#define CHIP8_OP_HANDLER(name, opcode) &runInstruction<Op::name>,
+	CHIP8_OPS(CHIP8_OP_HANDLER)
+#undef CHIP8_OP_HANDLER
+};
+
+void Emulator::runJitInstruction(Emulator* emulator, uint64_t packedInstruction) {
+	Instruction in;
+	std::memcpy(static_cast<void*>(&in), &packedInstruction, sizeof(in));
+
+	instructionHandlers[static_cast<int>(in.op)](*emulator, in);
+}
+
+void Emulator::runAotInstruction(Emulator* emulator, uint16_t opcode) {
+	Instruction in = decode(opcode);
+
+	instructionHandlers[static_cast<int>(in.op)](*emulator, in);
+}
+
+bool Emulator::step() {
+	return runCycles(1) == 1;
+}
+
+uint64_t Emulator::runCycles(uint64_t n) {
+	uint64_t executed = 0;
+	idle = false;
+
+	// head of the idle loop that has already run once since the timers last changed, -1 if none
+	int settledLoop = -1;
+
+	while (executed < n && running.load(std::memory_order_relaxed)) {
+		uint64_t remaining = n - executed;
+
+		// with cycle driven timers nothing runs past the next tick
+		if (cyclesPerTick != 0) {
+			if (cyclesUntilTick == 0 || cyclesUntilTick > cyclesPerTick) {
+				cyclesUntilTick = cyclesPerTick;
+			}
+			if (cyclesUntilTick < remaining) {
+				remaining = cyclesUntilTick;
+			}
+		}
+
+		uint64_t slice = remaining < idleCheckInterval ? remaining : idleCheckInterval;
+		uint64_t skipped = 0;
+
+		// PC may be at any instruction of a polling loop
+		for (uint16_t offset = 0; offset < 3 && offset * 2 <= PC; ++offset) {
+			uint16_t head = PC - offset * 2;
+			uint16_t length = pollingLoopLength(head);
+
+			if (length <= offset) {
+				continue;
+			}
+
+			if (offset == 0 && isIdleLoop(head)) {
+				idle = true;
+
+				if (settledLoop == head) {
+					/* after one iteration every further one leaves the machine in
+					the same state, so all that fit are skipped but still counted*/
+					skipped = remaining - remaining % length;
+					slice = remaining % length;
+				}
+				else {
+					// Fx07 may still change Vx in the first iteration
+					settledLoop = head;
+					slice = length < remaining ? length : remaining;
+				}
+			}
+			else if (offset != 0) {
+				// the loop is only checked at its first instruction
+				uint64_t toHead = length - offset;
+				slice = toHead < remaining ? toHead : remaining;
+			}
+
+			break;
+		}
+
+		uint64_t done = slice != 0 ? runEngine(slice) : 0;
+		executed += skipped + done;
+
+		if (cyclesPerTick != 0) {
+			cyclesUntilTick -= skipped + done;
+
+			if (cyclesUntilTick == 0) {
+				tickTimers();
+				settledLoop = -1;
+			}
+		}
+
+		// stopped by an unknown opcode or stop()
+		if (done < slice) {
+			break;
+		}
+	}
+
+	cycles += executed;
+
+	return executed;
+}
+
+bool Emulator::isIdle() const {
+	return idle;
+}
+
+uint16_t Emulator::pollingLoopLength(uint16_t address) const {
+	if (address + 1 >= 4096) {
+		return 0;
+	}
+
+	Instruction first = decode((static_cast<uint16_t>(memory[address]) << 8) | memory[address + 1]);
+
+	// 1nnn jumping to itself
+	if (first.op == Op::JP && first.nnn == address) {
+		return 1;
+	}
+
+	if (address + 3 >= 4096) {
+		return 0;
+	}
+
+	Instruction second = decode((static_cast<uint16_t>(memory[address + 2]) << 8) | memory[address + 3]);
+
+	// Fx0A waits on itself
+	if (first.op == Op::LD_VX_K) {
+		return 1;
+	}
+
+	// Ex9E or ExA1 skipping a jump back to it
+	if ((first.op == Op::SKP || first.op == Op::SKNP) && second.op == Op::JP && second.nnn == address) {
+		return 2;
+	}
+
+	if (address + 5 >= 4096) {
+		return 0;
+	}
+
+	Instruction third = decode((static_cast<uint16_t>(memory[address + 4]) << 8) | memory[address + 5]);
+
+	// Fx07, 3xkk or 4xkk skipping a jump back to the Fx07
+	if (first.op == Op::LD_VX_DT && (second.op == Op::SE_BYTE || second.op == Op::SNE_BYTE) &&
+		second.x == first.x && third.op == Op::JP && third.nnn == address) {
+		return 3;
+	}
+
+	return 0;
+}
+
+bool Emulator::isIdleLoop(uint16_t address) const {
+	Instruction first = decode((static_cast<uint16_t>(memory[address]) << 8) | memory[address + 1]);
+
+	switch (first.op) {
+	case Op::JP:
+		return true;
+
+	case Op::LD_VX_K: {
+		// the first execution starts waiting, after that only a pressed key ends the wait
+		std::lock_guard<std::mutex> lock(keyMutex);
+		return !waitingForKey || pendingKeys.empty();
+	}
+
+	case Op::SKP:
+		// the loop is left once the key is pressed
+		return keyboard[V[first.x] & 0x0F] != 1;
+
+	case Op::SKNP:
+		return keyboard[V[first.x] & 0x0F] == 1;
+
+	case Op::LD_VX_DT: {
+		// the loop is left once DT reaches kk (3xkk) or leaves it (4xkk)
+		Instruction second = decode((static_cast<uint16_t>(memory[address + 2]) << 8) | memory[address + 3]);
+
+		if (second.op == Op::SE_BYTE) {
+			return DT != second.kk;
+		}
+		return DT == second.kk;
+	}
+
+	default:
+		return false;
+	}
+}
+
+uint64_t Emulator::runEngine(uint64_t n) {
+	uint64_t executed;
+
+	// the other engines only implement the modern behaviour
+	if (quirkProfile != QuirkProfile::MODERN) {
+		executed = (this->*interpreter)(n);
+	}
+	else if (executionMode == ExecutionMode::AOT) {
+		executed = runAot(n);
+	}
+	else if (executionMode == ExecutionMode::IR) {
+		executed = runIr(n);
+	}
+	else if (executionMode == ExecutionMode::JIT) {
+		executed = runJit(n);
+	}
+	else if (executionMode == ExecutionMode::BLOCK_CACHE) {
+		executed = runBlocks(n);
+	}
+	else {
+		executed = (this->*interpreter)(n);
+	}
+
+	return executed;
+}
+
+template <class Quirks>
+uint64_t Emulator::interpret(uint64_t n) {
+	uint64_t executed = 0;
+
+	/* TABLE_DISPATCH calls the handler of the opcode straight from a table
+	with an entry for every possible opcode. THREADED_DISPATCH makes every
+	handler jump directly to the handler of the next instruction, otherwise
+	a single switch picks the handler of every instruction*/
+#ifdef TABLE_DISPATCH
+	static constexpr std::array<OpcodeHandler, 0x10000> handlers = makeOpcodeHandlers<Quirks>();
+
+	while (executed < n && running.load(std::memory_order_relaxed)) {
+		PC &= addressMask;
+
+		// forming the 16 bit instruction from two 8 bit numbers
+		uint16_t opcode = (static_cast<uint16_t>(memory[PC]) << 8) | memory[PC + 1];
+
+		traceInstruction();
+
+		if (!handlers[opcode](*this, opcode)) {
+			break;
+		}
+
+		executed++;
+	}
+#elif CHIP8_THREADED_DISPATCH
+	const Instruction* in;
+
+	static void* const handlers[] = {
+		&&handle_UNKNOWN,
+#define CHIP8_OP_LABEL(name, opcode) &&handle_##name,
+		CHIP8_OPS(CHIP8_OP_LABEL)
+#undef CHIP8_OP_LABEL
+#define CHIP8_FUSED_OP_LABEL(name, first, length) &&handle_##name,
+		CHIP8_FUSED_OPS(CHIP8_FUSED_OP_LABEL)
+#undef CHIP8_FUSED_OP_LABEL
+	};
+
+#define DISPATCH() \
+	do { \
+		if (executed == n || !running.load(std::memory_order_relaxed)) { \
+			goto finished; \
+		} \
+		in = &fetch(); \
+		traceInstruction(); \
+		goto *handlers[static_cast<int>(in->op)]; \
+	} while (0)
+
+	DISPATCH();
+
+#define CHIP8_OP_TARGET(name, opcode) \
+	handle_##name: \
+		executeWith<Quirks, Op::name>(*in); \
+		executed++; \
+		DISPATCH();
+
+	CHIP8_OPS(CHIP8_OP_TARGET)
+#undef CHIP8_OP_TARGET
+
+	// when the whole sequence does not fit in n only its first instruction runs
+#define CHIP8_FUSED_OP_TARGET(name, first, length) \
+	handle_##name: \
+		if (n - executed >= length) { \
+			executed += executeFused<Quirks, Op::name>(*in); \
+		} \
+		else { \
+			executeWith<Quirks, Op::first>(*in); \
+			executed++; \
+		} \
+		DISPATCH();
+
+	CHIP8_FUSED_OPS(CHIP8_FUSED_OP_TARGET)
+#undef CHIP8_FUSED_OP_TARGET
+#undef DISPATCH
+
+handle_UNKNOWN:
+	unknownOpcode();
+
+finished:
+#else
+	while (executed < n && running.load(std::memory_order_relaxed)) {
+		const Instruction& in = fetch();
+
+		traceInstruction();
+
+		switch (in.op) {
+#define CHIP8_OP_CASE(name, opcode) \
+		case Op::name: \
+			executeWith<Quirks, Op::name>(in); \
+			break;
+
+		CHIP8_OPS(CHIP8_OP_CASE)
+#undef CHIP8_OP_CASE
+
+		// when the whole sequence does not fit in n only its first instruction runs
+#define CHIP8_FUSED_OP_CASE(name, first, length) \
+		case Op::name: \
+			if (n - executed >= length) { \
+				executed += executeFused<Quirks, Op::name>(in); \
+				continue; \
+			} \
+			executeWith<Quirks, Op::first>(in); \
+			break;
+
+		CHIP8_FUSED_OPS(CHIP8_FUSED_OP_CASE)
+#undef CHIP8_FUSED_OP_CASE
+
+		case Op::UNKNOWN:
+			// an unknown opcode stops the emulator and is not counted
+			unknownOpcode();
+			continue;
+		}
 
-	for (int i = 0; i < 4096; ++i) {
-		memory[i] = 0;
+		executed++;
 	}
+#endif
+
+#ifdef DEFERRED_DRAWING
+	// the frontend reads the display as soon as the interpreter returns
+	flushDraws();
+#endif
 
-	// loading the program in memory
-	for (int i = 0; i < programLength; ++i) {
-		memory[i + 512] = program[i];
+#if CHIP8_DEFERRED_VF
+	// everything outside of the interpreter reads VF directly
+	if (flagOp != Op::UNKNOWN) {
+		writeFlag();
 	}
+#endif
 
-	// allocating memory for the V
-	V = new uint8_t[16];
+	return executed;
+}
 
-	for (int i = 0; i < 16; ++i) {
-		V[i] = 0;
-	}
+uint64_t Emulator::runBlocks(uint64_t n) {
+	uint64_t executed = 0;
 
-	// allocating memory for the display
-	display = new uint8_t*[displayX];
+	while (executed < n && running.load(std::memory_order_relaxed)) {
+		Block* block = blockCache.find(PC);
 
-	for (int i = 0; i < displayX; ++i) {
-		display[i] = new uint8_t[displayY];
-		for (int j = 0; j < displayY; ++j) {
-			display[i][j] = 0;
+		if (block == nullptr) {
+			block = compileBlock(PC);
 		}
-	}
 
-	// allocating memory for the keyboard keys
-	keyboard = new uint8_t[16];
+		/* the interpreter handles whatever can not be run as a block, and
+		the last few instructions when the block does not fit in n*/
+		if (block == nullptr || block->instructions.size() > n - executed) {
+			if (interpret<ModernQuirks>(1) == 0) {
+				break;
+			}
 
-	for (int i = 0; i < 16; ++i) {
-		keyboard[i] = 0;
-	}
+			executed++;
+			continue;
+		}
+
+		/* the block may be dropped by a write from its last instruction,
+		which keeps reading its operands while it writes. So it runs from a
+		copy and nothing of the block is touched after that*/
+		const CompiledInstruction* next = block->instructions.data();
+		size_t length = block->instructions.size();
+
+		for (size_t i = 1; i < length; ++i, ++next) {
+			next->handler(*this, next->in);
+		}
 
-	// storing the sprites of hexadecimal digits in memory
-	uint8_t digitSprites[] = { 0xF0, 0x90, 0x90, 0x90, 0xF0,
-	0x20, 0x60, 0x20, 0x20, 0x70,
-	0xF0, 0x10, 0xF0, 0x80, 0xF0,
-	0xF0, 0x10, 0xF0, 0x10, 0xF0,
-	0x90, 0x90, 0xF0, 0x10, 0x10,
-	0xF0, 0x80, 0xF0, 0x10, 0xF0,
-	0xF0, 0x80, 0xF0, 0x90, 0xF0,
-	0xF0, 0x10, 0x20, 0x40, 0x40,
-	0xF0, 0x90, 0xF0, 0x90, 0xF0,
-	0xF0, 0x90, 0xF0, 0x10, 0xF0,
-	0xF0, 0x90, 0xF0, 0x90, 0x90,
-	0xE0, 0x90, 0xE0, 0x90, 0xE0,
-	0xF0, 0x80, 0x80, 0x80, 0xF0,
-	0xE0, 0x90, 0x90, 0x90, 0xE0,
-	0xF0, 0x80, 0xF0, 0x80, 0xF0,
-	0xF0, 0x80, 0xF0, 0x80, 0x80 };
+		CompiledInstruction last = *next;
+		last.handler(*this, last.in);
 
-	for (int i = 0; i < 80; ++i) {
-		memory[i] = digitSprites[i];
+		executed += length;
 	}
 
-	// allocating memory for the stack
-	stack = new uint16_t[50];
+	return executed;
 }
 
-void Emulator::startEmulator() {
-	bool newKeyPressed = false;
-	uint8_t newKeyCode;
+uint64_t Emulator::runIr(uint64_t n) {
+	uint64_t executed = 0;
 
-	auto func = [&](uint8_t key) {
-		newKeyPressed = true;
-		newKeyCode = key;
-		};
+	while (executed < n && running.load(std::memory_order_relaxed)) {
+		Block* block = blockCache.find(PC);
 
-	Chip8IO io(display, keyboard, ST, func);
+		if (block == nullptr) {
+			block = compileBlock(PC);
+		}
 
-	// handeling all the IO operations in a separate thread
-	std::thread ioThread([&]() {
-		io.startIO();
-	});
+		// the same fallback as runBlocks
+		if (block == nullptr || block->instructions.size() > n - executed) {
+			if (interpret<ModernQuirks>(1) == 0) {
+				break;
+			}
 
-	// timer used for delay timer and sound timer registers
-	sf::Clock timer;
+			executed++;
+			continue;
+		}
 
-#ifdef PRINT_INSTRUCTION
-	std::cout << "Location | Instruction" << std::endl;
-#endif
+		if (block->ir.empty()) {
+			block->ir = liftBlock(*block);
+		}
 
-	while (true) {
-		// starting the timer
-		sf::Clock clock;
+		// counted first, the last instruction may drop the block
+		executed += block->instructions.size();
 
-		// forming the 16 bit instruction from two 8 bit numbers
-		uint16_t ins = (static_cast<uint16_t>(memory[PC]) << 8) | memory[PC + 1];
+		runIrBlock(*block);
+	}
+
+	return executed;
+}
 
-		// finding the four nibbles of the instruction
-		uint16_t a = ins >> 12,
-			b = (ins & 0x0F00) >> 8,
-			c = (ins & 0x00F0) >> 4,
-			d = ins & 0x000F;
+void Emulator::runIrBlock(const Block& block) {
+	for (const IrInstruction* ir = block.ir.data();; ++ir) {
+		uint8_t x = ir->x, y = ir->y;
 
-#ifdef PRINT_REGISTERS
-		std::cout << "V[0-F] = ";
-		for (int i = 0; i < 16; ++i) {
-			std::cout << static_cast<int>(V[i]) << ", ";
+		switch (ir->op) {
+		case IrOp::SET:
+			V[x] = ir->value;
+			break;
+		case IrOp::MOVE:
+			V[x] = V[y];
+			break;
+		case IrOp::ADD_VALUE:
+			V[x] += ir->value;
+			break;
+		case IrOp::OR:
+			V[x] |= V[y];
+			break;
+		case IrOp::AND:
+			V[x] &= V[y];
+			break;
+		case IrOp::XOR:
+			V[x] ^= V[y];
+			break;
+		case IrOp::ADD:
+			V[15] = V[x] + V[y] > 0xFF ? 1 : 0;
+			V[x] += V[y];
+			break;
+		case IrOp::SUB:
+			V[15] = V[x] >= V[y] ? 1 : 0;
+			V[x] -= V[y];
+			break;
+		case IrOp::SUBN:
+			V[15] = V[x] >= V[y] ? 0 : 1;
+			V[x] = V[y] - V[x];
+			break;
+		case IrOp::SHR:
+			V[15] = V[x] & 0x01;
+			V[x] >>= 1;
+			break;
+		case IrOp::SHL:
+			V[15] = V[x] >> 7;
+			V[x] <<= 1;
+			break;
+		case IrOp::ADD_NO_FLAG:
+			V[x] += V[y];
+			break;
+		case IrOp::SUB_NO_FLAG:
+			V[x] -= V[y];
+			break;
+		case IrOp::SUBN_NO_FLAG:
+			V[x] = V[y] - V[x];
+			break;
+		case IrOp::SHR_NO_FLAG:
+			V[x] >>= 1;
+			break;
+		case IrOp::SHL_NO_FLAG:
+			V[x] <<= 1;
+			break;
+		case IrOp::SET_I:
+			I = ir->operand;
+			break;
+		case IrOp::ADD_I:
+			I += V[x];
+			break;
+		case IrOp::ADD_I_VALUE:
+			I += ir->value;
+			break;
+		case IrOp::FONT:
+			I = 5 * V[x];
+			break;
+		case IrOp::LOAD_DT:
+			V[x] = DT;
+			break;
+		case IrOp::STORE_DT:
+			DT = V[x];
+			break;
+		case IrOp::STORE_ST:
+			ST = V[x];
+			break;
+		case IrOp::CALL: {
+			const CompiledInstruction& call = block.instructions[ir->operand];
+
+			PC = block.start + 2 * ir->operand;
+			call.handler(*this, call.in);
+			break;
 		}
+		case IrOp::CALL_EXIT: {
+			// run from a copy like the last instruction of runBlocks
+			CompiledInstruction call = block.instructions[ir->operand];
 
-		std::cout << "\nI = " << I << " S = " << SP << " PC = " << PC
-			<< " DT = " << DT << " ST = " << ST << std::endl;
-#endif
+			PC = block.start + 2 * ir->operand;
+			call.handler(*this, call.in);
+			return;
+		}
+		case IrOp::JUMP:
+			PC = ir->operand;
+			return;
+		case IrOp::SKIP_EQ:
+			PC = ir->operand + (V[x] == ir->value ? 4 : 2);
+			return;
+		case IrOp::SKIP_NE:
+			PC = ir->operand + (V[x] != ir->value ? 4 : 2);
+			return;
+		case IrOp::SKIP_EQ_REG:
+			PC = ir->operand + (V[x] == V[y] ? 4 : 2);
+			return;
+		case IrOp::SKIP_NE_REG:
+			PC = ir->operand + (V[x] != V[y] ? 4 : 2);
+			return;
+		}
+	}
+}
 
-#ifdef PRINT_INSTRUCTION
-		std::cout << PC << "|" << toHex(a) << toHex(b) << toHex(c) << toHex(d) << std::endl;
-#endif
-		switch (a) {
-		case hx0:
-			// 0nnn is ignored 
-
-			// 00E0 - CLS
-			if (b == hx0 && c == hxE && d == hx0) {
-				for (int i = 0; i < displayX; ++i) {
-					for (int j = 0; j < displayY; ++j) {
-						display[i][j] = 0;
-					}
-				}
+uint64_t Emulator::runJit(uint64_t n) {
+	if (!Jit::isSupported()) {
+		return runBlocks(n);
+	}
 
-				PC += 2;
-			}
+	uint64_t executed = 0;
 
-			// 00EE - RET
-			else if (b == hx0 && c == hxE && d == hxE) {
-				PC = stack[SP];
-				// 2 is added to the program counter so as not to call again
-				PC += 2;
-				SP--;
-			}
-			else {
-				std::cout << "^\n";
-				std::cout << "|Unknown OPCODE\n";
-			}
+	while (executed < n && running.load(std::memory_order_relaxed)) {
+		uint64_t remaining = n - executed;
 
-			break;
+		JitBlock* block = jit.find(PC);
 
-		case hx1:
-			// 1nnn - JP addr
+		if (block == nullptr) {
+			block = jit.compile(PC, memory);
+		}
 
-			PC = getLastThreeNibbles(ins);
-			break;
+		// Fx0A, unknown opcodes and the last few cycles are interpreted
+		if (block == nullptr || block->length > remaining) {
+			if (interpret<ModernQuirks>(1) == 0) {
+				break;
+			}
 
-		case hx2:
-			// 2nnn - CALL addr
-			SP++;
-			stack[SP] = PC;
+			executed++;
+			continue;
+		}
 
-			PC = getLastThreeNibbles(ins);
+		jitContext.budget = static_cast<int64_t>(remaining);
+		jitContext.lastExit = nullptr;
 
-			break;
+		jit.enter(jitContext, block);
 
-		case hx3:
-			// 3xkk - SE Vx, byte
-			if (V[b] == getLastTwoNibbles(ins)) {
-				// we increment by 4 instead of 2 as one instruction is two 
-				// bytes long
-				PC += 4;
-			}
-			else {
-				PC += 2;
-			}
+		executed += remaining - static_cast<uint64_t>(jitContext.budget);
 
-			break;
+		// the block left for a constant address, chain it to the next block
+		if (jitContext.lastExit != nullptr) {
+			uint64_t generation = jit.generation;
+			JitBlock* next = jit.find(PC);
 
-		case hx4:
-			// 4xkk - SNE Vx, byte
-			if (V[b] != getLastTwoNibbles(ins)) {
-				// we increment by 4 instead of 2 as one instruction is two 
-				// bytes long
-				PC += 4;
+			if (next == nullptr) {
+				next = jit.compile(PC, memory);
 			}
-			else {
-				PC += 2;
+
+			if (next != nullptr && generation == jit.generation) {
+				jit.link(jitContext.lastExit, next);
 			}
+		}
+	}
 
-			break;
+	return executed;
+}
 
-		case hx5:
-			// 5xy0 - SE Vx, Vy
-			if (d == hx0) {
-				if (V[b] == V[c]) {
-					// we increment by 4 instead of 2 as one instruction is two 
-					// bytes long
-					PC += 4;
-				}
-				else {
-					PC += 2;
-				}
-			}
-			else {
-				std::cout << "^\n";
-				std::cout << "|Unknown OPCODE\n";
-				std::cout << "|--------------\n";
+uint64_t Emulator::runAot(uint64_t n) {
+	uint64_t executed = 0;
+
+	while (executed < n && running.load(std::memory_order_relaxed)) {
+		const AotBlock* block = aot.find(PC);
+
+		// code the recompiler did not find or that was overwritten is interpreted
+		if (block == nullptr || block->length > n - executed) {
+			if (interpret<ModernQuirks>(1) == 0) {
+				break;
 			}
 
-			break;
+			executed++;
+			continue;
+		}
 
-		case hx6:
-			// 6xkk - LD Vx, byte
-			V[b] = getLastTwoNibbles(ins);
+		block->run(aotContext);
+		executed += block->length;
+	}
 
-			PC += 2;
+	return executed;
+}
 
-			break;
+Block* Emulator::compileBlock(uint16_t address) {
+	std::unique_ptr<Block> block(new Block());
+	block->start = address;
 
-		case hx7:
-			// 7xkk - ADD Vx, byte
-			V[b] += getLastTwoNibbles(ins);
+	uint16_t pc = address;
 
-			PC += 2;
+	while (pc + 1 < 4096 && block->instructions.size() < BlockCache::maxBlockLength) {
+		uint16_t opcode = (static_cast<uint16_t>(memory[pc]) << 8) | memory[pc + 1];
+		Instruction in = decode(opcode);
 
+		// unknown opcodes are left to the interpreter
+		if (in.op == Op::UNKNOWN) {
 			break;
+		}
 
-		case hx8:
-			switch (d) {
-			case hx0:
-				V[b] = V[c];
-				break;
+		block->instructions.push_back({ instructionHandlers[static_cast<int>(in.op)], in });
+		pc += 2;
 
-			case hx1:
-				V[b] |= V[c];
-				break;
+		if (endsBlock(in.op)) {
+			break;
+		}
+	}
 
-			case hx2:
-				V[b] &= V[c];
-				break;
+	if (block->instructions.empty()) {
+		return nullptr;
+	}
 
-			case hx3:
-				V[b] ^= V[c];
-				break;
+	block->end = pc;
 
-			case hx4: {
-				uint16_t sum = static_cast<uint16_t>(V[b]) + static_cast<uint16_t>(V[c]);
+	return blockCache.insert(std::move(block));
+}
 
-				if ((sum & 0xFF00) == 0) {
-					V[15] = 0;
-				}
-				else {
-					V[15] = 1;
-				}
+void Emulator::traceInstruction() {
+#ifdef PRINT_REGISTERS
+#if CHIP8_DEFERRED_VF
+	if (flagOp != Op::UNKNOWN) {
+		writeFlag();
+	}
+#endif
 
-				V[b] = static_cast<uint8_t>(sum & 0x00FF);
-				break;
-			}
+	std::cout << "V[0-F] = ";
+	for (int i = 0; i < 16; ++i) {
+		std::cout << static_cast<int>(V[i]) << ", ";
+	}
 
-			case hx5:
-				if (V[b] >= V[c]) {
-					V[15] = 1;
-				}
-				else {
-					V[15] = 0;
-				}
+	std::cout << "\nI = " << I << " S = " << SP << " PC = " << PC
+		<< " DT = " << DT << " ST = " << ST << std::endl;
+#endif
 
-				V[b] -= V[c];
+#ifdef PRINT_INSTRUCTION
+	std::cout << PC << "|" << toHex(memory[PC] >> 4) << toHex(memory[PC] & 0x0F)
+		<< toHex(memory[PC + 1] >> 4) << toHex(memory[PC + 1] & 0x0F) << std::endl;
+#endif
+}
 
-				break;
+const Instruction& Emulator::fetch() {
+	// a jump or return past 0xFFF wraps around
+	PC &= addressMask;
 
-			case hx6:
-				if ((V[b] & 0x01) == 1) {
-					V[15] = 1;
-				}
-				else {
-					V[15] = 0;
-				}
+	// forming the 16 bit instruction from two 8 bit numbers
+	uint16_t opcode = (static_cast<uint16_t>(memory[PC]) << 8) | memory[PC + 1];
 
-				// ik the compiler optimizes division like this but still ...
-				V[b] >>= 1;
+	// instructions at odd addresses are never cached
+	if ((PC & 1) != 0) {
+		uncachedInstruction = decode(opcode);
+		return uncachedInstruction;
+	}
 
-				break;
+	Instruction& in = decodeCache[PC >> 1];
 
-			case hx7:
-				if (V[b] >= V[c]) {
-					V[15] = 0;
-				}
-				else {
-					V[15] = 1;
-				}
+	if (!in.cached) {
+		in = decode(opcode);
+		in.cached = true;
 
-				V[b] = V[c] - V[b];
+		fuseInstructions(PC);
+	}
 
-				break;
+	return in;
+}
 
-			case hxE:
-				if ((V[b] & 0x80) != 0) {
-					V[15] = 1;
-				}
-				else {
-					V[15] = 0;
-				}
+void Emulator::fuseInstructions(uint16_t address) {
+	if (address + 3 >= 4096) {
+		return;
+	}
 
-				// ik the compiler optimizes division like this but still ...
-				V[b] <<= 1;
+	Instruction& in = decodeCache[address >> 1];
 
-				break;
-			default:
-				std::cout << "^\n";
-				std::cout << "|Unknown OPCODE\n";
-				std::cout << "|--------------\n";
-				return;
-			}
+	// the next instructions are only looked at, they are decoded once a sequence matches
+	Op second = opcodeTable[(static_cast<uint16_t>(memory[address + 2]) << 8) | memory[address + 3]];
+	Op third = Op::UNKNOWN;
 
-			PC += 2;
+	if (address + 5 < 4096) {
+		third = opcodeTable[(static_cast<uint16_t>(memory[address + 4]) << 8) | memory[address + 5]];
+	}
 
-			break;
+	Op fused = Op::UNKNOWN;
+	uint16_t length = 0;
 
-		case hx9:
-			// 9xy0 - SNE Vx, Vy
-			if (d == 0) {
-				if (V[b] != V[c]) {
-					PC += 4;
-				}
-				else {
-					PC += 2;
-				}
-			}
-			else {
-				std::cout << "^\n";
-				std::cout << "|Unknown OPCODE\n";
-				std::cout << "|--------------\n";
-			}
+	if (in.op == Op::LD_BYTE && second == Op::LD_BYTE && third == Op::DRW) {
+		fused = Op::LD_LD_DRW;
+		length = 3;
+	}
+	else if (in.op == Op::LD_I && second == Op::DRW) {
+		fused = Op::LD_I_DRW;
+		length = 2;
+	}
+	else if (in.op == Op::ADD_BYTE && second == Op::SE_BYTE && third == Op::JP) {
+		fused = Op::ADD_SE_JP;
+		length = 3;
+	}
+	else if (in.op == Op::LD_VX_DT && second == Op::SE_BYTE && third == Op::JP) {
+		fused = Op::DT_SE_JP;
+		length = 3;
+	}
 
-			break;
+	if (fused == Op::UNKNOWN) {
+		return;
+	}
 
-		case hxA:
-			// Annn - LD I, addr
-			I = getLastThreeNibbles(ins);
-			PC += 2;
+	/* the super-instruction reads the operands of the rest of the sequence
+	from the entries after it, only op changes if they are fused themselves*/
+	for (uint16_t i = 1; i < length; ++i) {
+		cacheInstruction(address + 2 * i);
+	}
 
-			break;
+	in.op = fused;
+}
 
-		case hxB:
-			// Bnnn - JP V0, addr
-			PC = getLastThreeNibbles(ins) + V[0];
+Instruction& Emulator::cacheInstruction(uint16_t address) {
+	Instruction& in = decodeCache[address >> 1];
 
-			break;
+	if (!in.cached) {
+		in = decode((static_cast<uint16_t>(memory[address]) << 8) | memory[address + 1]);
+		in.cached = true;
+	}
+
+	return in;
+}
 
-		case hxC: {
-			// Cxkk - RND Vx, byte
+void Emulator::writeFlag() {
+	// the same results as the eager versions in execute
+	switch (flagOp) {
+	case Op::ADD_REG:
+		V[15] = flagX + flagY > 0xFF ? 1 : 0;
+		break;
+	case Op::SUB:
+		V[15] = flagX >= flagY ? 1 : 0;
+		break;
+	case Op::SUBN:
+		V[15] = flagX >= flagY ? 0 : 1;
+		break;
+	case Op::SHR:
+		V[15] = flagX & 0x01;
+		break;
+	case Op::SHL:
+		V[15] = flagX >> 7;
+		break;
+	case Op::DRW:
+		// the collision is only known once the sprites are drawn
+		flushDraws();
+		break;
+	default:
+		break;
+	}
 
-			std::random_device rd;
-			std::mt19937 gen(rd());
-			std::uniform_int_distribution<> distrib(0, 255);
+	flagOp = Op::UNKNOWN;
+}
 
-			V[b] = getLastTwoNibbles(ins) & distrib(gen);
+void Emulator::flushDraws() {
+	if (deferredDrawCount == 0) {
+		return;
+	}
 
-			PC += 2;
+	/* only the collision of the last sprite can still be read, the ones
+	before it are combined first and XORed onto the display in one pass*/
+	if (deferredDrawCount > 1) {
+		uint64_t combined[displayY] = {};
 
-			break;
+		for (int i = 0; i < deferredDrawCount - 1; ++i) {
+			const DeferredDraw& draw = deferredDraws[i];
+
+			blitSprite(combined, draw.sprite, draw.n, draw.x, draw.y, draw.wrap);
 		}
 
-		case hxD: {
-			// Dxyn - DRW Vx, Vy, nibble
+		for (int i = 0; i < displayY; ++i) {
+			display[i] ^= combined[i];
+		}
+	}
 
-			V[15] = 0;
-#ifdef PRINT_SPRITE
-			std::cout << "Drawing sprite at " << static_cast<int>(V[b]) << ", " 
-				<< static_cast<int>(V[c]) << std::endl;
-#endif
-			// looping through all the bytes that store the sprite
-			for (uint16_t i = 0; i < d; ++i) {
+	const DeferredDraw& last = deferredDraws[deferredDrawCount - 1];
+	uint64_t collision = blitSprite(display, last.sprite, last.n, last.x, last.y, last.wrap);
 
-#ifdef PRINT_SPRITE
-				std::cout << toHex((static_cast<uint16_t>(memory[i + I]) & 0x00F0) >> 4) <<
-					toHex(static_cast<uint16_t>(memory[i + I]) & 0x000F) << std::endl;
-#endif
+	deferredDrawCount = 0;
 
-				// temporary variable used to disylay the byte
-				uint8_t t = 0x80;
-
-				// used to store the final state of the pixel
-				uint8_t f;
-
-				// used to store the original state of the pixel
-				uint8_t o;
-
-				// displaying one byte of the sprite
-				for (uint16_t j = 0; j < 8; ++j) {
-					int x = (V[b] + j) % displayX, y = (V[c] + i) % displayY;
-					o = display[x][y];
-					if ((memory[i + I] & t) != 0) {
-						if (o == 1) {
-							f = 0;
-							V[15] = 1;
-						}
-						else {
-							f = 1;
-						}
-					}
-					else {
-						if (o == 1) {
-							f = 1;
-						}
-						else {
-							f = 0;
-						}
-					}
-
-					// setting the bit on or off according to a
-					display[x][y] = f;
-#ifdef PRINT_SPRITE
-					if (f == 1) {
-						std::cout << "& ";
-					}
-					else {
-						std::cout << ". ";
-					}
-#endif
-					t >>= 1;
-				}
-#ifdef PRINT_SPRITE
-				std::cout << std::endl;
-#endif
-			}
+	if (flagOp == Op::DRW) {
+		V[15] = collision != 0 ? 1 : 0;
+		flagOp = Op::UNKNOWN;
+	}
+}
 
-			PC += 2;
-			break;
-		}
+void Emulator::writeMemory(uint16_t address, uint8_t value) {
+	address &= addressMask;
+	memory[address] = value;
 
-		case hxE:
-			// Ex9E - SKP Vx
+	if (address < memoryPadding) {
+		memory[4096 + address] = value;
+	}
 
-			if (c == hx9 && d == hxE) {
-				if (keyboard[V[b]] == 1) {
-					PC += 4;
-				}
-				else {
-					PC += 2;
-				}
-			}
-			else if (c == hxA && d == hx1) {
-				if (keyboard[V[b]] != 1) {
-					PC += 4;
-				}
-				else {
-					PC += 2;
-				}
-			}
-			else {
-				std::cout << "^\n";
-				std::cout << "|Unknown OPCODE\n";
-				std::cout << "|--------------\n";
-				return;
-			}
-			break;
+	/* the byte may be part of an already decoded instruction or block, a
+	super-instruction starts at most two instructions earlier*/
+	for (int i = address >> 1; i >= 0 && i >= (address >> 1) - 2; --i) {
+		decodeCache[i].cached = false;
+	}
+	blockCache.invalidate(address);
+	jit.invalidate(address);
+	aot.invalidate(address);
+}
 
-		case hxF:
-			switch (getLastTwoNibbles(ins)) {
-			case 0x07:
-				// Fx07 - LD Vx, DT
+uint64_t Emulator::runFrame() {
+	// runCycles ticks the timers itself
+	if (cyclesPerTick != 0) {
+		return runCycles(cyclesPerTick);
+	}
 
-				V[b] = DT;
-				break;
+	uint64_t executed = runCycles(instructionsPerFrame);
 
-			case 0x0A:
-				newKeyPressed = false;
-				while(true) {
-					if (newKeyPressed) {
-						V[b] = newKeyCode; 
-						break;
-					}
-				}
-				break;
+	tickTimers();
 
-			case 0x15:
-				DT = V[b];
-				break;
+	return executed;
+}
 
-			case 0x18:
-				ST = V[b];
-				break;
+void Emulator::tickTimers() {
+	if (ST > 0) {
+		ST--;
+	}
+	if (DT > 0) {
+		DT--;
+	}
+}
 
-			case 0x1E:
-				I += V[b];
-				break;
+void Emulator::stop() {
+	running = false;
 
-			case 0x29:
-				I = 5 * V[b];
-				break;
+	// wakes up a frontend blocked in waitForKey
+	std::lock_guard<std::mutex> lock(keyMutex);
+	keyCondition.notify_all();
+}
 
-			case 0x33:
-				memory[I] = V[b] / 100;
-				memory[I + 1] = (V[b] % 100) / 10;
-				memory[I + 2] = V[b] % 10;
-				break;
+bool Emulator::isRunning() const {
+	return running;
+}
 
-			case 0x55:
-				for (int i = 0; i <= b; ++i) {
-					memory[I + i] = V[i];
-				}
-				break;
+void Emulator::keyPressed(uint8_t key) {
+	std::lock_guard<std::mutex> lock(keyMutex);
 
-			case 0x65:
-				for (int i = 0; i <= b; ++i) {
-					V[i] = memory[I + i];
-				}
-				break;
+	if (waitingForKey) {
+		pendingKeys.push_back(key);
+		keyCondition.notify_all();
+	}
+}
 
-			default:
-				std::cout << "^\n";
-				std::cout << "|Unknown OPCODE\n";
-				std::cout << "|--------------\n";
-				return;
-			}
-			PC += 2;
-		}
+bool Emulator::isWaitingForKey() const {
+	std::lock_guard<std::mutex> lock(keyMutex);
 
-#ifndef FAST_EXECUTION
-		while (clock.getElapsedTime().asMicroseconds() < 10000) {}
-#endif
-		if (timer.getElapsedTime().asMicroseconds() > 16667) {
-			if (ST > 0) {
-				ST--;
-			}
-			if (DT > 0) {
-				DT--;
-			}
+	return waitingForKey && pendingKeys.empty();
+}
+
+bool Emulator::waitForKey(std::chrono::steady_clock::time_point deadline) {
+	std::unique_lock<std::mutex> lock(keyMutex);
+
+	return keyCondition.wait_until(lock, deadline, [this]() {
+		return !pendingKeys.empty() || !running;
+	}) && !pendingKeys.empty();
+}
+
+void Emulator::seedRandom(uint64_t seed) {
+	randomState = randomStateFromSeed(seed);
+}
+
+uint8_t Emulator::nextRandom() {
+	return nextRandomByte(randomState);
+}
+
+Machine Emulator::snapshot() const {
+	return *this;
+}
 
-			timer.restart();
+void Emulator::restore(const Machine& state) {
+	// restoring the same program keeps everything that was decoded or compiled
+	for (int i = 0; i < 4096; ++i) {
+		if (memory[i] != state.memory[i]) {
+			writeMemory(i, state.memory[i]);
 		}
+	}
 
-#ifdef SLOW_EXECUTION
-		newKeyPressed = false;
-		while (!newKeyPressed) {}
-#endif
+	static_cast<Machine&>(*this) = state;
+
+	// a pending Fx0A starts waiting again when it is executed
+	{
+		std::lock_guard<std::mutex> lock(keyMutex);
+		waitingForKey = false;
+		pendingKeys.clear();
 	}
+
+	idle = false;
 }
 
-Emulator::~Emulator() {
-	delete[] stack;
-	delete[] keyboard;
+void Emulator::setQuirkProfile(QuirkProfile profile) {
+	quirkProfile = profile;
 
-	for (int i = 0; i < displayX; ++i) {
-		delete[] display[i];
+	if (profile == QuirkProfile::COSMAC) {
+		interpreter = &Emulator::interpret<CosmacQuirks>;
+	}
+	else if (profile == QuirkProfile::SUPER_CHIP) {
+		interpreter = &Emulator::interpret<SuperChipQuirks>;
+	}
+	else {
+		interpreter = &Emulator::interpret<ModernQuirks>;
 	}
-	delete[] display;
-	delete[] memory;
-	delete[] V;
+}
+
+bool Emulator::loadAot(const std::string& path, std::string& error) {
+	return aot.load(path, memory, error);
+}
+
+void Emulator::unknownOpcode() {
+	std::cerr << "^\n";
+	std::cerr << "|Unknown OPCODE\n";
+	std::cerr << "|--------------\n";
+
+	stop();
+}
+
+Emulator::~Emulator() {
+	delete[] decodeCache;
 }
 
 inline char Emulator::toHex(uint16_t nibble) {
@@ -2,15 +2,44 @@
 
 #include <iostream>
 #include <random>
-#include <thread>
-#include <functional>
-#include <SFML/System.hpp>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <array>
+#include <string>
+#include "machine.h"
+#include "instruction.h"
+#include "quirks.h"
+#include "blockCache.h"
+#include "jit.h"
+#include "aot.h"
+#include "spriteBlit.h"
 
-class Emulator {
-public:
-	uint8_t* memory;
-	uint8_t* V;
+enum class ExecutionMode {
+	// fetches, decodes and dispatches every instruction on its own
+	INTERPRETER,
+	// runs whole basic blocks that are compiled once and cached
+	BLOCK_CACHE,
+	/* translates basic blocks to x86-64 code, falls back to BLOCK_CACHE
+	on other hosts*/
+	JIT,
+	/* runs the blocks of a plugin loaded with loadAot, everything else is
+	interpreted*/
+	AOT,
+	/* runs blocks lifted into an optimized IR (see ir.h) on an interpreter
+	for the IR, portable to any host*/
+	IR
+};
 
+/* the emulator core, it never touches SFML or creates any threads so it can
+be driven headless at full host speed. A frontend (see chip8IO.h) calls
+runFrame / runCycles and reads display, keyboard and ST from outside. The
+machine state itself is inherited from Machine*/
+class Emulator : public Machine {
+public:
 	static const uint16_t hx0 = 0x000,
 		hx1 = 0x001,
 		hx2 = 0x002,
@@ -28,30 +57,233 @@ public:
 		hxE = 0x00E,
 		hxF = 0x00F;
 
-	/*program counter and stack pointer registers
-	program counter is set to 512 as most chip 8
-	programs start at memory location 512 */
-	uint16_t PC = 512, SP = 0;
-
-	uint16_t* stack;
-
-	/*delay time register and sound time register,
-	both these registers are decremented at 60Hz*/
-	uint8_t DT = 0, ST = 0;
+	// number of instructions executed by one call to runFrame
+	int instructionsPerFrame = 10;
 
-	uint16_t I = 0;
+	// total number of instructions executed since the emulator was created
+	uint64_t cycles = 0;
 
-	uint8_t** display;
+	/* when not 0 the timers are derived from the instruction count instead
+	of the host clock, runCycles ticks them once every cyclesPerTick
+	instructions. A run is then the same no matter how fast the host is*/
+	uint64_t cyclesPerTick = 0;
 
-	// 1 means pressed 0 means not pressed
-	uint8_t* keyboard;
+	ExecutionMode executionMode = ExecutionMode::INTERPRETER;
 
-	int displayX = 64, displayY = 32;
+	// set with setQuirkProfile
+	QuirkProfile quirkProfile = QuirkProfile::MODERN;
 
 	Emulator(const uint8_t* program, int programLength);
 	~Emulator();
-	void startEmulator();
+
+	/* executes a single instruction, returns false if the emulator
+	has been stopped (either by stop() or by an unknown opcode)*/
+	bool step();
+
+	/* executes at most n instructions and returns the number of
+	instructions that were actually executed. Iterations of an idle loop
+	(see isIdle) are skipped but still counted*/
+	uint64_t runCycles(uint64_t n);
+
+	/* executes instructionsPerFrame instructions and then decrements
+	the timers once, i.e. one 60Hz frame of emulated time. With
+	cyclesPerTick set a frame is cyclesPerTick instructions instead*/
+	uint64_t runFrame();
+
+	// decrements DT and ST, should be called at 60Hz
+	void tickTimers();
+
+	void stop();
+	bool isRunning() const;
+
+	/* true if the last runCycles ended in a loop that only waits for DT or
+	for a key (or jumps to itself) or on Fx0A, nothing changes until the
+	timers tick or a key is pressed so a frontend can sleep until then*/
+	bool isIdle() const;
+
+	/* should be called by the frontend whenever a new key is pressed,
+	it is used by Fx0A. Can be called from any thread*/
+	void keyPressed(uint8_t key);
+
+	/* true if execution is stuck on Fx0A until a key is pressed, calling
+	runCycles again resumes once keyPressed has been called*/
+	bool isWaitingForKey() const;
+
+	/* blocks until a key is pressed for Fx0A, the emulator is stopped or
+	deadline has passed. Returns true if a key is available*/
+	bool waitForKey(std::chrono::steady_clock::time_point deadline);
+
+	/* restarts the sequence of random numbers used by Cxkk, the same seed
+	always gives the same sequence. The constructor seeds it from
+	std::random_device*/
+	void seedRandom(uint64_t seed);
+
+	// a copy of the machine state, see restore
+	Machine snapshot() const;
+
+	/* replaces the machine state with state, e.g. one returned by snapshot
+	on this or on another emulator. Decoded and compiled code is only thrown
+	away for the bytes of memory that differ*/
+	void restore(const Machine& state);
+
+	/* loads a plugin built from the source written by recompile() for the
+	program in memory, used by ExecutionMode::AOT*/
+	bool loadAot(const std::string& path, std::string& error);
+
+	/* selects the interpreter instantiated for profile. Any profile other
+	than MODERN always runs on the interpreter, whatever executionMode is*/
+	void setQuirkProfile(QuirkProfile profile);
+
 	inline uint16_t getLastThreeNibbles(uint16_t instruction);
 	inline uint8_t getLastTwoNibbles(uint16_t instruction);
 	inline char toHex(uint16_t nibble);
+
+private:
+	// atomic so that a frontend can stop the core from another thread
+	std::atomic<bool> running{ true };
+
+	/* Fx0A does not block the core, the instruction is executed again until
+	a key has been pressed since it started waiting. runCycles treats this
+	like an idle loop and a frontend can block in waitForKey instead*/
+	bool waitingForKey = false;
+
+	// keys pressed since Fx0A started waiting, filled by keyPressed from any thread
+	std::deque<uint8_t> pendingKeys;
+	mutable std::mutex keyMutex;
+	std::condition_variable keyCondition;
+
+	// set by runCycles, see isIdle
+	bool idle = false;
+
+	// instructions left until the timers tick when cyclesPerTick is used
+	uint64_t cyclesUntilTick = 0;
+
+	// instructions runCycles executes between two checks for an idle loop
+	static const uint64_t idleCheckInterval = 8192;
+
+	// number of instructions of the polling loop starting at address, 0 if there is none
+	uint16_t pollingLoopLength(uint16_t address) const;
+
+	// true if the polling loop starting at address can not be left with the current state
+	bool isIdleLoop(uint16_t address) const;
+
+	/* predecoded instructions indexed by PC / 2, an entry is only
+	invalidated when Fx33 or Fx55 write to one of its two bytes or to an
+	instruction it was fused with*/
+	Instruction* decodeCache;
+	Instruction uncachedInstruction;
+
+	/* the handlers used by TABLE_DISPATCH, they return false if the
+	opcode could not be executed*/
+	using OpcodeHandler = bool (*)(Emulator&, uint16_t);
+
+	template <class Quirks, Op op>
+	static bool handleOpcode(Emulator& emulator, uint16_t opcode);
+	static bool handleUnknownOpcode(Emulator& emulator, uint16_t opcode);
+	template <class Quirks>
+	static constexpr std::array<OpcodeHandler, 0x10000> makeOpcodeHandlers();
+
+	/* the handlers stored in compiled blocks, the block runs them one
+	after the other without fetching or decoding*/
+	template <Op op>
+	static void runInstruction(Emulator& emulator, const Instruction& in);
+
+	using InstructionHandler = void (*)(Emulator&, const Instruction&);
+
+	// runInstruction for every Op, in the same order as Op
+	static const InstructionHandler instructionHandlers[];
+
+	// called by compiled code for instructions that are not translated
+	static void runJitInstruction(Emulator* emulator, uint64_t packedInstruction);
+
+	// called by recompiled blocks for instructions that are not translated
+	static void runAotInstruction(Emulator* emulator, uint16_t opcode);
+
+	BlockCache blockCache;
+	Jit jit;
+	JitContext jitContext;
+	Aot aot;
+	AotContext aotContext;
+
+	// runs at most n instructions with the engine of executionMode
+	uint64_t runEngine(uint64_t n);
+
+	template <class Quirks>
+	uint64_t interpret(uint64_t n);
+
+	// interpret for the profile chosen by setQuirkProfile
+	uint64_t (Emulator::*interpreter)(uint64_t) = &Emulator::interpret<ModernQuirks>;
+	uint64_t runBlocks(uint64_t n);
+	uint64_t runJit(uint64_t n);
+	uint64_t runAot(uint64_t n);
+	uint64_t runIr(uint64_t n);
+
+	// executes the IR of block, PC is set by its last IR instruction
+	void runIrBlock(const Block& block);
+
+	// returns nullptr if no block can be compiled at address
+	Block* compileBlock(uint16_t address);
+
+	// executes one instruction, there is a specialization for every Op
+	template <Op op>
+	void execute(const Instruction& in);
+
+	// execute with the behaviour of a quirk profile (see quirks.h)
+	template <class Quirks, Op op>
+	void executeWith(const Instruction& in);
+
+	// Dxyn, sprites wrap around the screen unless clip is true
+	template <bool clip>
+	void drawSprite(const Instruction& in);
+
+	// used by drawSprite, the SIMD version picked for the host
+	SpriteBlitFunction blitSprite = selectSpriteBlit();
+
+	/* executes a super-instruction of CHIP8_FUSED_OPS, the instructions it
+	replaced follow in in the decode cache. Returns how many of them were
+	executed, the sequence is left early when a skip jumps over the rest*/
+	template <class Quirks, Op op>
+	uint64_t executeFused(const Instruction& in);
+
+	const Instruction& fetch();
+
+	// replaces the cached instruction at address with a super-instruction if possible
+	void fuseInstructions(uint16_t address);
+	Instruction& cacheInstruction(uint16_t address);
+	void traceInstruction();
+	void writeMemory(uint16_t address, uint8_t value);
+
+	/* the last instruction of producesFlag (or Dxyn) whose VF has not been
+	written yet with LAZY_FLAGS (or DEFERRED_DRAWING), Op::UNKNOWN if VF is
+	up to date. flagX and flagY
+	are the operands it had*/
+	Op flagOp = Op::UNKNOWN;
+	uint8_t flagX = 0, flagY = 0;
+
+	// writes VF for flagOp
+	void writeFlag();
+
+	// a Dxyn that has not been drawn yet with DEFERRED_DRAWING
+	struct DeferredDraw {
+		uint8_t x, y, n;
+		bool wrap;
+		uint8_t sprite[memoryPadding];
+	};
+
+	static const int maxDeferredDraws = 64;
+
+	DeferredDraw deferredDraws[maxDeferredDraws];
+	int deferredDrawCount = 0;
+
+	// adds Dxyn to deferredDraws, used by the interpreter with DEFERRED_DRAWING
+	void deferSprite(const Instruction& in, bool wrap);
+
+	/* draws the deferred sprites in order, VF is written if it still has
+	to be the collision of the last one*/
+	void flushDraws();
+
+	// the next byte of the Cxkk generator
+	uint8_t nextRandom();
+
+	void unknownOpcode();
 };
\ No newline at end of file
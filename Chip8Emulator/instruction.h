@@ -0,0 +1,222 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+
+/* every instruction the emulator understands, the names follow the
+mnemonics in instruction_set.txt. X(name, opcode) is expanded once per
+instruction so the dispatch tables always stay in the same order as Op*/
+#define CHIP8_OPS(X) \
+	X(CLS, "00E0") \
+	X(RET, "00EE") \
+	X(JP, "1nnn") \
+	X(CALL, "2nnn") \
+	X(SE_BYTE, "3xkk") \
+	X(SNE_BYTE, "4xkk") \
+	X(SE_REG, "5xy0") \
+	X(LD_BYTE, "6xkk") \
+	X(ADD_BYTE, "7xkk") \
+	X(LD_REG, "8xy0") \
+	X(OR, "8xy1") \
+	X(AND, "8xy2") \
+	X(XOR, "8xy3") \
+	X(ADD_REG, "8xy4") \
+	X(SUB, "8xy5") \
+	X(SHR, "8xy6") \
+	X(SUBN, "8xy7") \
+	X(SHL, "8xyE") \
+	X(SNE_REG, "9xy0") \
+	X(LD_I, "Annn") \
+	X(JP_V0, "Bnnn") \
+	X(RND, "Cxkk") \
+	X(DRW, "Dxyn") \
+	X(SKP, "Ex9E") \
+	X(SKNP, "ExA1") \
+	X(LD_VX_DT, "Fx07") \
+	X(LD_VX_K, "Fx0A") \
+	X(LD_DT_VX, "Fx15") \
+	X(LD_ST_VX, "Fx18") \
+	X(ADD_I_VX, "Fx1E") \
+	X(LD_F_VX, "Fx29") \
+	X(LD_B_VX, "Fx33") \
+	X(LD_I_VX, "Fx55") \
+	X(LD_VX_I, "Fx65")
+
+/* super-instructions that replace common sequences in the decode cache,
+they are never produced by decode(). X(name, first, length) where first is
+the Op of the first instruction of the sequence and length the number of
+instructions it replaces*/
+#define CHIP8_FUSED_OPS(X) \
+	X(LD_LD_DRW, LD_BYTE, 3) \
+	X(LD_I_DRW, LD_I, 2) \
+	X(ADD_SE_JP, ADD_BYTE, 3) \
+	X(DT_SE_JP, LD_VX_DT, 3)
+
+// UNKNOWN is used for every invalid encoding
+enum class Op : uint8_t {
+	UNKNOWN,
+#define CHIP8_OP_ENUM(name, opcode) name,
+	CHIP8_OPS(CHIP8_OP_ENUM)
+#undef CHIP8_OP_ENUM
+#define CHIP8_FUSED_OP_ENUM(name, first, length) name,
+	CHIP8_FUSED_OPS(CHIP8_FUSED_OP_ENUM)
+#undef CHIP8_FUSED_OP_ENUM
+};
+
+/* an instruction with all of its operands already extracted, so that
+executing it does not need to look at the opcode again*/
+struct Instruction {
+	Op op = Op::UNKNOWN;
+	uint8_t x = 0, y = 0, n = 0, kk = 0;
+
+	// set when this entry of the decode cache holds a decoded instruction
+	bool cached = false;
+
+	uint16_t nnn = 0;
+};
+
+// extracts the operands of an opcode without looking at which instruction it is
+constexpr Instruction decodeOperands(uint16_t opcode) {
+	Instruction in;
+
+	in.x = static_cast<uint8_t>((opcode & 0x0F00) >> 8);
+	in.y = static_cast<uint8_t>((opcode & 0x00F0) >> 4);
+	in.n = static_cast<uint8_t>(opcode & 0x000F);
+	in.kk = static_cast<uint8_t>(opcode & 0x00FF);
+	in.nnn = opcode & 0x0FFF;
+
+	return in;
+}
+
+/* finds which instruction an opcode encodes, this is only used to
+generate opcodeTable at compile time*/
+constexpr Op classifyOpcode(uint16_t opcode) {
+	uint8_t n = static_cast<uint8_t>(opcode & 0x000F);
+	uint8_t kk = static_cast<uint8_t>(opcode & 0x00FF);
+
+	switch (opcode >> 12) {
+	case 0x0:
+		// 0nnn is ignored
+		if (opcode == 0x00E0) {
+			return Op::CLS;
+		}
+		else if (opcode == 0x00EE) {
+			return Op::RET;
+		}
+		break;
+
+	case 0x1: return Op::JP;
+	case 0x2: return Op::CALL;
+	case 0x3: return Op::SE_BYTE;
+	case 0x4: return Op::SNE_BYTE;
+
+	case 0x5:
+		if (n == 0x0) {
+			return Op::SE_REG;
+		}
+		break;
+
+	case 0x6: return Op::LD_BYTE;
+	case 0x7: return Op::ADD_BYTE;
+
+	case 0x8:
+		switch (n) {
+		case 0x0: return Op::LD_REG;
+		case 0x1: return Op::OR;
+		case 0x2: return Op::AND;
+		case 0x3: return Op::XOR;
+		case 0x4: return Op::ADD_REG;
+		case 0x5: return Op::SUB;
+		case 0x6: return Op::SHR;
+		case 0x7: return Op::SUBN;
+		case 0xE: return Op::SHL;
+		}
+		break;
+
+	case 0x9:
+		if (n == 0x0) {
+			return Op::SNE_REG;
+		}
+		break;
+
+	case 0xA: return Op::LD_I;
+	case 0xB: return Op::JP_V0;
+	case 0xC: return Op::RND;
+	case 0xD: return Op::DRW;
+
+	case 0xE:
+		if (kk == 0x9E) {
+			return Op::SKP;
+		}
+		else if (kk == 0xA1) {
+			return Op::SKNP;
+		}
+		break;
+
+	case 0xF:
+		switch (kk) {
+		case 0x07: return Op::LD_VX_DT;
+		case 0x0A: return Op::LD_VX_K;
+		case 0x15: return Op::LD_DT_VX;
+		case 0x18: return Op::LD_ST_VX;
+		case 0x1E: return Op::ADD_I_VX;
+		case 0x29: return Op::LD_F_VX;
+		case 0x33: return Op::LD_B_VX;
+		case 0x55: return Op::LD_I_VX;
+		case 0x65: return Op::LD_VX_I;
+		}
+		break;
+	}
+
+	return Op::UNKNOWN;
+}
+
+constexpr std::array<Op, 0x10000> makeOpcodeTable() {
+	std::array<Op, 0x10000> table{};
+
+	for (uint32_t opcode = 0; opcode < 0x10000; ++opcode) {
+		table[opcode] = classifyOpcode(static_cast<uint16_t>(opcode));
+	}
+
+	return table;
+}
+
+// the instruction encoded by every possible 16 bit opcode
+inline constexpr std::array<Op, 0x10000> opcodeTable = makeOpcodeTable();
+
+inline Instruction decode(uint16_t opcode) {
+	Instruction in = decodeOperands(opcode);
+	in.op = opcodeTable[opcode];
+
+	return in;
+}
+
+/* true for instructions that can change the control flow or write to
+memory, a basic block always ends with one of these*/
+constexpr bool endsBlock(Op op) {
+	switch (op) {
+	case Op::RET:
+	case Op::JP:
+	case Op::CALL:
+	case Op::SE_BYTE:
+	case Op::SNE_BYTE:
+	case Op::SE_REG:
+	case Op::SNE_REG:
+	case Op::JP_V0:
+	case Op::SKP:
+	case Op::SKNP:
+	case Op::LD_VX_K:
+	case Op::LD_B_VX:
+	case Op::LD_I_VX:
+	case Op::UNKNOWN:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// the arithmetic instructions that set VF to a carry, borrow or shifted out bit
+constexpr bool producesFlag(Op op) {
+	return op == Op::ADD_REG || op == Op::SUB || op == Op::SHR || op == Op::SUBN || op == Op::SHL;
+}
\ No newline at end of file
@@ -0,0 +1,419 @@
+#include "ir.h"
+#include "blockCache.h"
+
+namespace {
+
+const uint16_t allRegisters = 0xFFFF;
+const uint16_t flagRegister = 1 << 15;
+
+uint16_t bit(int index) {
+	return static_cast<uint16_t>(1 << index);
+}
+
+bool writesFlag(IrOp op) {
+	return op == IrOp::ADD || op == IrOp::SUB || op == IrOp::SUBN || op == IrOp::SHR || op == IrOp::SHL;
+}
+
+// the same operation without the VF write
+IrOp withoutFlag(IrOp op) {
+	switch (op) {
+	case IrOp::ADD:
+		return IrOp::ADD_NO_FLAG;
+	case IrOp::SUB:
+		return IrOp::SUB_NO_FLAG;
+	case IrOp::SUBN:
+		return IrOp::SUBN_NO_FLAG;
+	case IrOp::SHR:
+		return IrOp::SHR_NO_FLAG;
+	default:
+		return IrOp::SHL_NO_FLAG;
+	}
+}
+
+// V registers an instruction reads, a call may read any of them
+uint16_t reads(const IrInstruction& ir) {
+	switch (ir.op) {
+	case IrOp::MOVE:
+		return bit(ir.y);
+	case IrOp::ADD_VALUE:
+	case IrOp::SHR:
+	case IrOp::SHL:
+	case IrOp::SHR_NO_FLAG:
+	case IrOp::SHL_NO_FLAG:
+	case IrOp::ADD_I:
+	case IrOp::FONT:
+	case IrOp::STORE_DT:
+	case IrOp::STORE_ST:
+	case IrOp::SKIP_EQ:
+	case IrOp::SKIP_NE:
+		return bit(ir.x);
+	case IrOp::OR:
+	case IrOp::AND:
+	case IrOp::XOR:
+	case IrOp::ADD:
+	case IrOp::SUB:
+	case IrOp::SUBN:
+	case IrOp::ADD_NO_FLAG:
+	case IrOp::SUB_NO_FLAG:
+	case IrOp::SUBN_NO_FLAG:
+	case IrOp::SKIP_EQ_REG:
+	case IrOp::SKIP_NE_REG:
+		return bit(ir.x) | bit(ir.y);
+	case IrOp::CALL:
+	case IrOp::CALL_EXIT:
+		return allRegisters;
+	default:
+		return 0;
+	}
+}
+
+// V registers an instruction writes, a call may write any of them
+uint16_t writes(const IrInstruction& ir) {
+	switch (ir.op) {
+	case IrOp::SET:
+	case IrOp::MOVE:
+	case IrOp::ADD_VALUE:
+	case IrOp::OR:
+	case IrOp::AND:
+	case IrOp::XOR:
+	case IrOp::ADD_NO_FLAG:
+	case IrOp::SUB_NO_FLAG:
+	case IrOp::SUBN_NO_FLAG:
+	case IrOp::SHR_NO_FLAG:
+	case IrOp::SHL_NO_FLAG:
+	case IrOp::LOAD_DT:
+		return bit(ir.x);
+	case IrOp::ADD:
+	case IrOp::SUB:
+	case IrOp::SUBN:
+	case IrOp::SHR:
+	case IrOp::SHL:
+		return bit(ir.x) | flagRegister;
+	case IrOp::CALL:
+	case IrOp::CALL_EXIT:
+		return allRegisters;
+	default:
+		return 0;
+	}
+}
+
+// true if the only effect of the instruction is writing V registers
+bool onlyWritesRegisters(IrOp op) {
+	return op <= IrOp::SHL_NO_FLAG || op == IrOp::LOAD_DT;
+}
+
+class Lifter {
+public:
+	std::vector<IrInstruction> code;
+
+	explicit Lifter(const Block& block) : block(block) {
+		forgetAll();
+	}
+
+	void lift() {
+		size_t length = block.instructions.size();
+
+		for (size_t i = 0; i < length; ++i) {
+			const Instruction& in = block.instructions[i].in;
+			uint16_t pc = static_cast<uint16_t>(block.start + 2 * i);
+
+			if (!liftInstruction(in, pc)) {
+				// everything without an IR translation runs the instruction itself
+				bool last = i + 1 == length;
+				emit(last ? IrOp::CALL_EXIT : IrOp::CALL, 0, 0, 0, static_cast<uint16_t>(i));
+				forgetAll();
+
+				if (last) {
+					return;
+				}
+			}
+
+			// jumps and skips are always the last instruction of a block
+			if (endsBlock(in.op)) {
+				return;
+			}
+		}
+
+		// the block ended without changing the control flow
+		emit(IrOp::JUMP, 0, 0, 0, block.end);
+	}
+
+private:
+	const Block& block;
+
+	// registers whose value is known at this point of the block
+	bool known[16];
+	uint8_t values[16];
+
+	void emit(IrOp op, uint8_t x, uint8_t y, uint8_t value, uint16_t operand) {
+		code.push_back({ op, x, y, value, operand });
+	}
+
+	void set(uint8_t x, uint8_t value) {
+		emit(IrOp::SET, x, 0, value, 0);
+		known[x] = true;
+		values[x] = value;
+	}
+
+	void forgetAll() {
+		for (int i = 0; i < 16; ++i) {
+			known[i] = false;
+		}
+	}
+
+	void jump(uint16_t address) {
+		emit(IrOp::JUMP, 0, 0, 0, address);
+	}
+
+	// returns false if the instruction has to be called
+	bool liftInstruction(const Instruction& in, uint16_t pc) {
+		uint8_t x = in.x, y = in.y;
+
+		switch (in.op) {
+		case Op::JP:
+			jump(in.nnn);
+			return true;
+
+		case Op::SE_BYTE:
+		case Op::SNE_BYTE:
+			// a skip on a known register always goes the same way
+			if (known[x]) {
+				jump(pc + ((values[x] == in.kk) == (in.op == Op::SE_BYTE) ? 4 : 2));
+			}
+			else {
+				emit(in.op == Op::SE_BYTE ? IrOp::SKIP_EQ : IrOp::SKIP_NE, x, 0, in.kk, pc);
+			}
+			return true;
+
+		case Op::SE_REG:
+		case Op::SNE_REG:
+			if (known[x] && known[y]) {
+				jump(pc + ((values[x] == values[y]) == (in.op == Op::SE_REG) ? 4 : 2));
+			}
+			else {
+				emit(in.op == Op::SE_REG ? IrOp::SKIP_EQ_REG : IrOp::SKIP_NE_REG, x, y, 0, pc);
+			}
+			return true;
+
+		case Op::LD_BYTE:
+			set(x, in.kk);
+			return true;
+
+		case Op::ADD_BYTE:
+			if (known[x]) {
+				set(x, static_cast<uint8_t>(values[x] + in.kk));
+			}
+			else {
+				emit(IrOp::ADD_VALUE, x, 0, in.kk, 0);
+			}
+			return true;
+
+		case Op::LD_REG:
+			if (known[y]) {
+				set(x, values[y]);
+			}
+			else {
+				emit(IrOp::MOVE, x, y, 0, 0);
+				known[x] = false;
+			}
+			return true;
+
+		case Op::OR:
+		case Op::AND:
+		case Op::XOR:
+			liftLogic(in);
+			return true;
+
+		case Op::ADD_REG:
+		case Op::SUB:
+		case Op::SUBN:
+		case Op::SHR:
+		case Op::SHL:
+			/* Emulator::execute writes VF before Vx, so when either of them
+			is VF the original instruction keeps that order*/
+			if (x == 15 || y == 15) {
+				return false;
+			}
+			liftArithmetic(in);
+			return true;
+
+		case Op::LD_I:
+			emit(IrOp::SET_I, 0, 0, 0, in.nnn);
+			return true;
+
+		case Op::ADD_I_VX:
+			if (known[x]) {
+				emit(IrOp::ADD_I_VALUE, 0, 0, values[x], 0);
+			}
+			else {
+				emit(IrOp::ADD_I, x, 0, 0, 0);
+			}
+			return true;
+
+		case Op::LD_F_VX:
+			if (known[x]) {
+				emit(IrOp::SET_I, 0, 0, 0, static_cast<uint16_t>(5 * values[x]));
+			}
+			else {
+				emit(IrOp::FONT, x, 0, 0, 0);
+			}
+			return true;
+
+		case Op::LD_VX_DT:
+			emit(IrOp::LOAD_DT, x, 0, 0, 0);
+			known[x] = false;
+			return true;
+
+		case Op::LD_DT_VX:
+			emit(IrOp::STORE_DT, x, 0, 0, 0);
+			return true;
+
+		case Op::LD_ST_VX:
+			emit(IrOp::STORE_ST, x, 0, 0, 0);
+			return true;
+
+		default:
+			return false;
+		}
+	}
+
+	void liftLogic(const Instruction& in) {
+		uint8_t x = in.x, y = in.y;
+
+		if (known[x] && known[y]) {
+			uint8_t result = in.op == Op::OR ? values[x] | values[y] :
+				in.op == Op::AND ? values[x] & values[y] : values[x] ^ values[y];
+
+			set(x, result);
+			return;
+		}
+
+		emit(in.op == Op::OR ? IrOp::OR : in.op == Op::AND ? IrOp::AND : IrOp::XOR, x, y, 0, 0);
+		known[x] = false;
+	}
+
+	void liftArithmetic(const Instruction& in) {
+		uint8_t x = in.x, y = in.y;
+		bool shift = in.op == Op::SHR || in.op == Op::SHL;
+
+		if (known[x] && (shift || known[y])) {
+			uint8_t a = values[x], b = values[y];
+			uint8_t result, flag;
+
+			switch (in.op) {
+			case Op::ADD_REG:
+				result = static_cast<uint8_t>(a + b);
+				flag = a + b > 0xFF ? 1 : 0;
+				break;
+			case Op::SUB:
+				result = static_cast<uint8_t>(a - b);
+				flag = a >= b ? 1 : 0;
+				break;
+			case Op::SUBN:
+				result = static_cast<uint8_t>(b - a);
+				flag = a >= b ? 0 : 1;
+				break;
+			case Op::SHR:
+				result = a >> 1;
+				flag = a & 0x01;
+				break;
+			default:
+				result = static_cast<uint8_t>(a << 1);
+				flag = a >> 7;
+				break;
+			}
+
+			set(15, flag);
+			set(x, result);
+			return;
+		}
+
+		IrOp op = in.op == Op::ADD_REG ? IrOp::ADD : in.op == Op::SUB ? IrOp::SUB :
+			in.op == Op::SUBN ? IrOp::SUBN : in.op == Op::SHR ? IrOp::SHR : IrOp::SHL;
+
+		emit(op, x, y, 0, 0);
+		known[x] = false;
+		known[15] = false;
+	}
+};
+
+// 7xkk 7xkk becomes one addition when nothing uses Vx in between
+void foldAdditions(std::vector<IrInstruction>& code) {
+	std::vector<IrInstruction> folded;
+
+	for (const IrInstruction& ir : code) {
+		if (ir.op == IrOp::ADD_VALUE) {
+			uint16_t x = bit(ir.x);
+			bool merged = false;
+
+			for (size_t j = folded.size(); j-- > 0;) {
+				IrInstruction& earlier = folded[j];
+
+				if (earlier.op == IrOp::ADD_VALUE && earlier.x == ir.x) {
+					earlier.value = static_cast<uint8_t>(earlier.value + ir.value);
+					merged = true;
+					break;
+				}
+
+				if (((reads(earlier) | writes(earlier)) & x) != 0) {
+					break;
+				}
+			}
+
+			if (merged) {
+				continue;
+			}
+		}
+
+		folded.push_back(ir);
+	}
+
+	code.swap(folded);
+}
+
+/* drops instructions whose results are all overwritten before they are
+read and the VF writes nothing reads, everything is read after the block*/
+void eliminateDeadStores(std::vector<IrInstruction>& code) {
+	uint16_t live = allRegisters;
+	std::vector<bool> dead(code.size(), false);
+
+	for (size_t i = code.size(); i-- > 0;) {
+		IrInstruction& ir = code[i];
+
+		if (onlyWritesRegisters(ir.op)) {
+			if (writesFlag(ir.op) && (live & flagRegister) == 0) {
+				ir.op = withoutFlag(ir.op);
+			}
+
+			if ((writes(ir) & live) == 0) {
+				dead[i] = true;
+				continue;
+			}
+		}
+
+		live = static_cast<uint16_t>((live & ~writes(ir)) | reads(ir));
+	}
+
+	std::vector<IrInstruction> alive;
+	alive.reserve(code.size());
+
+	for (size_t i = 0; i < code.size(); ++i) {
+		if (!dead[i]) {
+			alive.push_back(code[i]);
+		}
+	}
+
+	code.swap(alive);
+}
+
+}
+
+std::vector<IrInstruction> liftBlock(const Block& block) {
+	Lifter lifter(block);
+	lifter.lift();
+
+	foldAdditions(lifter.code);
+	eliminateDeadStores(lifter.code);
+
+	return std::move(lifter.code);
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct Block;
+
+/* the operations of the IR a block is lifted into. They work on the V
+registers directly, x, y, value and operand are the fields of
+IrInstruction they use*/
+enum class IrOp : uint8_t {
+	// V[x] = value
+	SET,
+	// V[x] = V[y]
+	MOVE,
+	// V[x] += value, no flag
+	ADD_VALUE,
+	// V[x] op= V[y]
+	OR,
+	AND,
+	XOR,
+	// V[x] op= V[y] and VF is the carry or borrow, neither x nor y is VF
+	ADD,
+	SUB,
+	SUBN,
+	// V[x] shifted by one and VF is the bit shifted out, x is not VF
+	SHR,
+	SHL,
+	// the same without writing VF, used when VF is overwritten before it is read
+	ADD_NO_FLAG,
+	SUB_NO_FLAG,
+	SUBN_NO_FLAG,
+	SHR_NO_FLAG,
+	SHL_NO_FLAG,
+	// I = operand
+	SET_I,
+	// I += V[x]
+	ADD_I,
+	// I += value
+	ADD_I_VALUE,
+	// I = 5 * V[x]
+	FONT,
+	// V[x] = DT
+	LOAD_DT,
+	// DT = V[x]
+	STORE_DT,
+	// ST = V[x]
+	STORE_ST,
+	/* runs the original instruction number operand of the block with PC
+	pointing at it, CALL_EXIT ends the block after it*/
+	CALL,
+	CALL_EXIT,
+	// PC = operand and the block ends
+	JUMP,
+	/* the block ends by skipping the instruction after operand if V[x]
+	is (or is not) value, or V[y] for the _REG versions*/
+	SKIP_EQ,
+	SKIP_NE,
+	SKIP_EQ_REG,
+	SKIP_NE_REG
+};
+
+struct IrInstruction {
+	IrOp op;
+	uint8_t x, y;
+	uint8_t value;
+	uint16_t operand;
+};
+
+/* lifts the instructions of block into IR, with constant propagation of
+6xkk, folded 7xkk chains and without the register and VF writes that are
+overwritten before anything reads them. Only the modern quirks are
+implemented, like the other engines*/
+std::vector<IrInstruction> liftBlock(const Block& block);
\ No newline at end of file
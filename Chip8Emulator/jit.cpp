@@ -0,0 +1,852 @@
+#include "jit.h"
+#include <cstddef>
+#include <cstring>
+
+#if CHIP8_JIT_SUPPORTED
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace {
+
+// size of the executable buffer, all code is thrown away when it is full
+const size_t codeBufferSize = 4 * 1024 * 1024;
+
+// longest block that will be compiled, in instructions
+const int maxBlockLength = 64;
+
+// the most code a single instruction can need, including its exits
+const size_t maxInstructionSize = 320;
+
+enum Reg : int {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+enum Cond : uint8_t {
+	BELOW = 0x2,
+	ABOVE_EQUAL = 0x3,
+	EQUAL = 0x4,
+	NOT_EQUAL = 0x5,
+	LESS = 0xC
+};
+
+// the /digit of the 0x81 and 0xC1 opcode groups
+enum Ext : int {
+	EXT_ADD = 0,
+	EXT_AND = 4,
+	EXT_SHL = 4,
+	EXT_SUB = 5,
+	EXT_SHR = 5,
+	EXT_CMP = 7
+};
+
+#ifdef _WIN32
+const int ARG0 = RCX, ARG1 = RDX;
+#else
+const int ARG0 = RDI, ARG1 = RSI;
+#endif
+
+/* rbx always points to the JitContext and r15 to V, rax, rcx and rdx are
+scratch registers and the rest hold V registers and I inside a block*/
+const int CONTEXT = RBX, VBASE = R15;
+const int blockRegisters[] = { RBP, R12, R13, R14, RSI, RDI, R8, R9, R10, R11 };
+const int blockRegisterCount = 10;
+
+// registers saved by the trampoline, in push order
+const int savedRegisters[] = { RBX, RBP, R12, R13, R14, R15, RSI, RDI };
+
+/* 8 pushes plus this keep the stack 16 byte aligned for helper calls
+and leave the 32 bytes of shadow space that Windows needs*/
+const int32_t frameSize = 40;
+
+const int32_t offsetV = offsetof(JitContext, V);
+const int32_t offsetI = offsetof(JitContext, I);
+const int32_t offsetPC = offsetof(JitContext, PC);
+const int32_t offsetDT = offsetof(JitContext, DT);
+const int32_t offsetST = offsetof(JitContext, ST);
+const int32_t offsetBudget = offsetof(JitContext, budget);
+const int32_t offsetEmulator = offsetof(JitContext, emulator);
+const int32_t offsetHelper = offsetof(JitContext, helper);
+const int32_t offsetLastExit = offsetof(JitContext, lastExit);
+
+// a minimal x86-64 encoder, only the forms used by the compiler are supported
+class Assembler {
+public:
+	explicit Assembler(uint8_t* out) : start(out), out(out) {}
+
+	size_t size() const { return out - start; }
+	uint8_t* position() const { return out; }
+
+	void byte(uint8_t value) { *out++ = value; }
+	void word(uint16_t value) { std::memcpy(out, &value, 2); out += 2; }
+	void int32(int32_t value) { std::memcpy(out, &value, 4); out += 4; }
+	void int64(uint64_t value) { std::memcpy(out, &value, 8); out += 8; }
+
+	// REX prefix, left out when it would be 0x40 unless force is set
+	void rex(bool wide, int reg, int base, bool force = false) {
+		uint8_t prefix = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) >> 1) | ((base & 8) >> 3);
+
+		if (prefix != 0x40 || force) {
+			byte(prefix);
+		}
+	}
+
+	void modrmReg(int reg, int rm) {
+		byte(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+	}
+
+	// [base + disp32]
+	void modrmMem(int reg, int base, int32_t disp) {
+		byte(static_cast<uint8_t>(0x80 | ((reg & 7) << 3) | (base & 7)));
+
+		if ((base & 7) == RSP) {
+			byte(0x24);
+		}
+
+		int32(disp);
+	}
+
+	void movImm(int dst, uint32_t imm) {
+		rex(false, 0, dst);
+		byte(static_cast<uint8_t>(0xB8 + (dst & 7)));
+		int32(static_cast<int32_t>(imm));
+	}
+
+	void movImm64(int dst, uint64_t imm) {
+		rex(true, 0, dst);
+		byte(static_cast<uint8_t>(0xB8 + (dst & 7)));
+		int64(imm);
+	}
+
+	void mov(int dst, int src) {
+		rex(false, src, dst);
+		byte(0x89);
+		modrmReg(src, dst);
+	}
+
+	void mov64(int dst, int src) {
+		rex(true, src, dst);
+		byte(0x89);
+		modrmReg(src, dst);
+	}
+
+	void load64(int dst, int base, int32_t disp) {
+		rex(true, dst, base);
+		byte(0x8B);
+		modrmMem(dst, base, disp);
+	}
+
+	void store64(int base, int32_t disp, int src) {
+		rex(true, src, base);
+		byte(0x89);
+		modrmMem(src, base, disp);
+	}
+
+	void loadByte(int dst, int base, int32_t disp) {
+		rex(false, dst, base);
+		byte(0x0F);
+		byte(0xB6);
+		modrmMem(dst, base, disp);
+	}
+
+	void loadWord(int dst, int base, int32_t disp) {
+		rex(false, dst, base);
+		byte(0x0F);
+		byte(0xB7);
+		modrmMem(dst, base, disp);
+	}
+
+	void storeByte(int base, int32_t disp, int src) {
+		// the REX prefix selects sil, dil and bpl instead of dh, bh and ch
+		rex(false, src, base, true);
+		byte(0x88);
+		modrmMem(src, base, disp);
+	}
+
+	void storeWord(int base, int32_t disp, int src) {
+		byte(0x66);
+		rex(false, src, base);
+		byte(0x89);
+		modrmMem(src, base, disp);
+	}
+
+	void storeWordImm(int base, int32_t disp, uint16_t imm) {
+		byte(0x66);
+		rex(false, 0, base);
+		byte(0xC7);
+		modrmMem(0, base, disp);
+		word(imm);
+	}
+
+	// zero extends the low byte of src into dst
+	void zeroExtendByte(int dst, int src) {
+		rex(false, dst, src, true);
+		byte(0x0F);
+		byte(0xB6);
+		modrmReg(dst, src);
+	}
+
+	// add 0x01, or 0x09, and 0x21, sub 0x29, xor 0x31, cmp 0x39
+	void alu(uint8_t opcode, int dst, int src) {
+		rex(false, src, dst);
+		byte(opcode);
+		modrmReg(src, dst);
+	}
+
+	void aluImm(int ext, int dst, int32_t imm) {
+		rex(false, 0, dst);
+		byte(0x81);
+		modrmReg(ext, dst);
+		int32(imm);
+	}
+
+	void aluImm64(int ext, int dst, int32_t imm) {
+		rex(true, 0, dst);
+		byte(0x81);
+		modrmReg(ext, dst);
+		int32(imm);
+	}
+
+	void aluImm64Mem(int ext, int base, int32_t disp, int32_t imm) {
+		rex(true, 0, base);
+		byte(0x81);
+		modrmMem(ext, base, disp);
+		int32(imm);
+	}
+
+	void shift(int ext, int dst, uint8_t amount) {
+		rex(false, 0, dst);
+		byte(0xC1);
+		modrmReg(ext, dst);
+		byte(amount);
+	}
+
+	void setcc(Cond cond, int dst) {
+		rex(false, 0, dst, true);
+		byte(0x0F);
+		byte(static_cast<uint8_t>(0x90 + cond));
+		modrmReg(0, dst);
+	}
+
+	void imulImm(int dst, int src, int8_t imm) {
+		rex(false, dst, src);
+		byte(0x6B);
+		modrmReg(dst, src);
+		byte(static_cast<uint8_t>(imm));
+	}
+
+	void jmp(const uint8_t* target) {
+		byte(0xE9);
+		int32(static_cast<int32_t>(target - (out + 4)));
+	}
+
+	void jcc(Cond cond, const uint8_t* target) {
+		byte(0x0F);
+		byte(static_cast<uint8_t>(0x80 + cond));
+		int32(static_cast<int32_t>(target - (out + 4)));
+	}
+
+	// a conditional jump whose target is set later by bind
+	uint8_t* jccForward(Cond cond) {
+		byte(0x0F);
+		byte(static_cast<uint8_t>(0x80 + cond));
+		int32(0);
+
+		return out - 4;
+	}
+
+	void bind(uint8_t* displacement) {
+		int32_t value = static_cast<int32_t>(out - (displacement + 4));
+		std::memcpy(displacement, &value, 4);
+	}
+
+	void jmpReg(int target) {
+		rex(false, 0, target);
+		byte(0xFF);
+		modrmReg(4, target);
+	}
+
+	void callReg(int target) {
+		rex(false, 0, target);
+		byte(0xFF);
+		modrmReg(2, target);
+	}
+
+	void push(int reg) {
+		rex(false, 0, reg);
+		byte(static_cast<uint8_t>(0x50 + (reg & 7)));
+	}
+
+	void pop(int reg) {
+		rex(false, 0, reg);
+		byte(static_cast<uint8_t>(0x58 + (reg & 7)));
+	}
+
+	void ret() {
+		byte(0xC3);
+	}
+
+private:
+	uint8_t* start;
+	uint8_t* out;
+};
+
+// instructions that are translated, everything else calls the helper
+bool isNative(Op op) {
+	switch (op) {
+	case Op::JP:
+	case Op::SE_BYTE:
+	case Op::SNE_BYTE:
+	case Op::SE_REG:
+	case Op::SNE_REG:
+	case Op::LD_BYTE:
+	case Op::ADD_BYTE:
+	case Op::LD_REG:
+	case Op::OR:
+	case Op::AND:
+	case Op::XOR:
+	case Op::ADD_REG:
+	case Op::SUB:
+	case Op::SHR:
+	case Op::SUBN:
+	case Op::SHL:
+	case Op::LD_I:
+	case Op::ADD_I_VX:
+	case Op::LD_F_VX:
+	case Op::LD_VX_DT:
+	case Op::LD_DT_VX:
+	case Op::LD_ST_VX:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+bool usesI(Op op) {
+	return op == Op::LD_I || op == Op::ADD_I_VX || op == Op::LD_F_VX;
+}
+
+class BlockCompiler {
+public:
+	BlockCompiler(Assembler& a, uint8_t* epilogue) : a(a), epilogue(epilogue) {
+		for (int i = 0; i < 16; ++i) {
+			vRegister[i] = -1;
+		}
+	}
+
+	void compile(const std::vector<Instruction>& instructions, uint16_t start) {
+		allocateRegisters(instructions);
+
+		// blocks only run if the whole block fits in the budget
+		int32_t length = static_cast<int32_t>(instructions.size());
+		a.aluImm64Mem(EXT_CMP, CONTEXT, offsetBudget, length);
+		a.jcc(LESS, epilogue);
+		a.aluImm64Mem(EXT_SUB, CONTEXT, offsetBudget, length);
+
+		loadRegisters();
+
+		uint16_t pc = start;
+
+		for (const Instruction& in : instructions) {
+			if (isNative(in.op)) {
+				emitNative(in, pc);
+			}
+			else {
+				emitHelper(in, pc);
+			}
+
+			pc += 2;
+		}
+
+		// the block was cut short before an instruction that ends it
+		if (!endsBlock(instructions.back().op)) {
+			writeBackRegisters();
+			exitTo(pc);
+		}
+	}
+
+private:
+	Assembler& a;
+	uint8_t* epilogue;
+
+	// host register of every V register, -1 if it stays in memory
+	int vRegister[16];
+	int iRegister = -1;
+
+	void allocateRegisters(const std::vector<Instruction>& instructions) {
+		int uses[16] = {};
+		bool needsI = false;
+
+		for (const Instruction& in : instructions) {
+			if (!isNative(in.op)) {
+				continue;
+			}
+
+			uses[in.x]++;
+			uses[in.y]++;
+			uses[15]++;
+			needsI = needsI || usesI(in.op);
+		}
+
+		int next = 0;
+
+		if (needsI) {
+			iRegister = blockRegisters[next++];
+		}
+
+		// the most used V registers get the remaining host registers
+		while (next < blockRegisterCount) {
+			int best = -1;
+
+			for (int i = 0; i < 16; ++i) {
+				if (vRegister[i] == -1 && uses[i] > 0 && (best == -1 || uses[i] > uses[best])) {
+					best = i;
+				}
+			}
+
+			if (best == -1) {
+				break;
+			}
+
+			vRegister[best] = blockRegisters[next++];
+		}
+	}
+
+	void loadRegisters() {
+		for (int i = 0; i < 16; ++i) {
+			if (vRegister[i] != -1) {
+				a.loadByte(vRegister[i], VBASE, i);
+			}
+		}
+
+		if (iRegister != -1) {
+			a.load64(RAX, CONTEXT, offsetI);
+			a.loadWord(iRegister, RAX, 0);
+		}
+	}
+
+	// does not change the flags, so it can sit between a cmp and its jump
+	void writeBackRegisters() {
+		for (int i = 0; i < 16; ++i) {
+			if (vRegister[i] != -1) {
+				a.storeByte(VBASE, i, vRegister[i]);
+			}
+		}
+
+		if (iRegister != -1) {
+			a.load64(RAX, CONTEXT, offsetI);
+			a.storeWord(RAX, 0, iRegister);
+		}
+	}
+
+	void loadV(int dst, int x) {
+		if (vRegister[x] != -1) {
+			a.mov(dst, vRegister[x]);
+		}
+		else {
+			a.loadByte(dst, VBASE, x);
+		}
+	}
+
+	// src must already be zero extended from 8 bits
+	void storeV(int x, int src) {
+		if (vRegister[x] != -1) {
+			a.mov(vRegister[x], src);
+		}
+		else {
+			a.storeByte(VBASE, x, src);
+		}
+	}
+
+	void storePC(uint16_t pc) {
+		a.load64(RAX, CONTEXT, offsetPC);
+		a.storeWordImm(RAX, 0, pc);
+	}
+
+	/* leaves the block for a constant address. The first jump goes to the
+	next instruction until Jit::link points it at the target block*/
+	void exitTo(uint16_t pc) {
+		storePC(pc);
+
+		uint8_t* exit = a.position();
+		a.jmp(exit + 5);
+
+		a.movImm64(RAX, reinterpret_cast<uint64_t>(exit));
+		a.store64(CONTEXT, offsetLastExit, RAX);
+		a.jmp(epilogue);
+	}
+
+	// emits a skip, flags must already hold the result of the comparison
+	void exitSkip(Cond noSkip, uint16_t pc) {
+		writeBackRegisters();
+
+		uint8_t* next = a.jccForward(noSkip);
+		exitTo(pc + 4);
+		a.bind(next);
+		exitTo(pc + 2);
+	}
+
+	void emitHelper(const Instruction& in, uint16_t pc) {
+		uint64_t packed;
+		static_assert(sizeof(Instruction) == sizeof(packed), "Instruction must fit in a register");
+		std::memcpy(&packed, &in, sizeof(packed));
+
+		writeBackRegisters();
+		storePC(pc);
+
+		a.load64(ARG0, CONTEXT, offsetEmulator);
+		a.movImm64(ARG1, packed);
+		a.load64(RAX, CONTEXT, offsetHelper);
+		a.callReg(RAX);
+
+		// the helper has already updated PC in memory
+		if (endsBlock(in.op)) {
+			a.jmp(epilogue);
+		}
+		else {
+			loadRegisters();
+		}
+	}
+
+	/* every instruction loads its operands, computes and stores in the
+	same order as the interpreter so that x or y being F behaves the same*/
+	void emitNative(const Instruction& in, uint16_t pc) {
+		switch (in.op) {
+		case Op::JP:
+			writeBackRegisters();
+			exitTo(in.nnn);
+			break;
+
+		case Op::SE_BYTE:
+			loadV(RAX, in.x);
+			a.aluImm(EXT_CMP, RAX, in.kk);
+			exitSkip(NOT_EQUAL, pc);
+			break;
+
+		case Op::SNE_BYTE:
+			loadV(RAX, in.x);
+			a.aluImm(EXT_CMP, RAX, in.kk);
+			exitSkip(EQUAL, pc);
+			break;
+
+		case Op::SE_REG:
+			loadV(RAX, in.x);
+			loadV(RCX, in.y);
+			a.alu(0x39, RAX, RCX);
+			exitSkip(NOT_EQUAL, pc);
+			break;
+
+		case Op::SNE_REG:
+			loadV(RAX, in.x);
+			loadV(RCX, in.y);
+			a.alu(0x39, RAX, RCX);
+			exitSkip(EQUAL, pc);
+			break;
+
+		case Op::LD_BYTE:
+			a.movImm(RAX, in.kk);
+			storeV(in.x, RAX);
+			break;
+
+		case Op::ADD_BYTE:
+			loadV(RAX, in.x);
+			a.aluImm(EXT_ADD, RAX, in.kk);
+			a.zeroExtendByte(RAX, RAX);
+			storeV(in.x, RAX);
+			break;
+
+		case Op::LD_REG:
+			loadV(RAX, in.y);
+			storeV(in.x, RAX);
+			break;
+
+		case Op::OR:
+		case Op::AND:
+		case Op::XOR: {
+			uint8_t opcode = in.op == Op::OR ? 0x09 : in.op == Op::AND ? 0x21 : 0x31;
+
+			loadV(RAX, in.x);
+			loadV(RCX, in.y);
+			a.alu(opcode, RAX, RCX);
+			storeV(in.x, RAX);
+			break;
+		}
+
+		case Op::ADD_REG:
+			loadV(RAX, in.x);
+			loadV(RCX, in.y);
+			a.alu(0x01, RAX, RCX);
+			a.mov(RDX, RAX);
+			a.shift(EXT_SHR, RDX, 8);
+			storeV(15, RDX);
+			a.zeroExtendByte(RAX, RAX);
+			storeV(in.x, RAX);
+			break;
+
+		case Op::SUB:
+			loadV(RAX, in.x);
+			loadV(RCX, in.y);
+			a.alu(0x31, RDX, RDX);
+			a.alu(0x39, RAX, RCX);
+			a.setcc(ABOVE_EQUAL, RDX);
+			storeV(15, RDX);
+
+			loadV(RAX, in.x);
+			loadV(RCX, in.y);
+			a.alu(0x29, RAX, RCX);
+			a.zeroExtendByte(RAX, RAX);
+			storeV(in.x, RAX);
+			break;
+
+		case Op::SHR:
+			loadV(RAX, in.x);
+			a.aluImm(EXT_AND, RAX, 1);
+			storeV(15, RAX);
+
+			loadV(RAX, in.x);
+			a.shift(EXT_SHR, RAX, 1);
+			storeV(in.x, RAX);
+			break;
+
+		case Op::SUBN:
+			loadV(RAX, in.x);
+			loadV(RCX, in.y);
+			a.alu(0x31, RDX, RDX);
+			a.alu(0x39, RAX, RCX);
+			a.setcc(BELOW, RDX);
+			storeV(15, RDX);
+
+			loadV(RAX, in.y);
+			loadV(RCX, in.x);
+			a.alu(0x29, RAX, RCX);
+			a.zeroExtendByte(RAX, RAX);
+			storeV(in.x, RAX);
+			break;
+
+		case Op::SHL:
+			loadV(RAX, in.x);
+			a.shift(EXT_SHR, RAX, 7);
+			storeV(15, RAX);
+
+			loadV(RAX, in.x);
+			a.shift(EXT_SHL, RAX, 1);
+			a.zeroExtendByte(RAX, RAX);
+			storeV(in.x, RAX);
+			break;
+
+		case Op::LD_I:
+			a.movImm(iRegister, in.nnn);
+			break;
+
+		case Op::ADD_I_VX:
+			loadV(RAX, in.x);
+			a.alu(0x01, iRegister, RAX);
+			a.aluImm(EXT_AND, iRegister, 0xFFFF);
+			break;
+
+		case Op::LD_F_VX:
+			loadV(RAX, in.x);
+			a.imulImm(iRegister, RAX, 5);
+			break;
+
+		case Op::LD_VX_DT:
+			a.load64(RCX, CONTEXT, offsetDT);
+			a.loadByte(RAX, RCX, 0);
+			storeV(in.x, RAX);
+			break;
+
+		case Op::LD_DT_VX:
+		case Op::LD_ST_VX:
+			loadV(RAX, in.x);
+			a.load64(RCX, CONTEXT, in.op == Op::LD_DT_VX ? offsetDT : offsetST);
+			a.storeByte(RCX, 0, RAX);
+			break;
+
+		default:
+			break;
+		}
+	}
+};
+
+}
+
+Jit::Jit() {
+	for (int i = 0; i < 4096; ++i) {
+		blockIndex[i] = -1;
+		covered[i] = false;
+	}
+}
+
+Jit::~Jit() {
+#if CHIP8_JIT_SUPPORTED
+	if (code != nullptr) {
+#ifdef _WIN32
+		VirtualFree(code, 0, MEM_RELEASE);
+#else
+		munmap(code, codeSize);
+#endif
+	}
+#endif
+}
+
+bool Jit::isSupported() {
+	return CHIP8_JIT_SUPPORTED != 0;
+}
+
+JitBlock* Jit::find(uint16_t address) {
+	if (address >= 4096 || blockIndex[address] == -1) {
+		return nullptr;
+	}
+
+	return &blocks[blockIndex[address]];
+}
+
+JitBlock* Jit::compile(uint16_t address, const uint8_t* memory) {
+	if (!isSupported() || address >= 4096) {
+		return nullptr;
+	}
+
+	if (code == nullptr && !allocate()) {
+		return nullptr;
+	}
+
+	std::vector<Instruction> instructions;
+	uint16_t pc = address;
+
+	while (pc + 1 < 4096 && static_cast<int>(instructions.size()) < maxBlockLength) {
+		uint16_t opcode = (static_cast<uint16_t>(memory[pc]) << 8) | memory[pc + 1];
+		Instruction in = decode(opcode);
+
+		// these are always left to the interpreter
+		if (in.op == Op::UNKNOWN || in.op == Op::LD_VX_K) {
+			break;
+		}
+
+		instructions.push_back(in);
+		pc += 2;
+
+		if (endsBlock(in.op)) {
+			break;
+		}
+	}
+
+	if (instructions.empty()) {
+		return nullptr;
+	}
+
+	if (codeSize - codeUsed < maxBlockLength * maxInstructionSize) {
+		clear();
+	}
+
+	Assembler a(code + codeUsed);
+	BlockCompiler compiler(a, epilogue);
+	compiler.compile(instructions, address);
+
+	JitBlock block;
+	block.start = address;
+	block.end = pc;
+	block.length = static_cast<uint32_t>(instructions.size());
+	block.entry = code + codeUsed;
+
+	codeUsed += a.size();
+
+	for (uint16_t i = block.start; i < block.end; ++i) {
+		covered[i] = true;
+	}
+
+	blockIndex[address] = static_cast<int32_t>(blocks.size());
+	blocks.push_back(block);
+
+	return &blocks.back();
+}
+
+void Jit::enter(JitContext& context, JitBlock* block) {
+	auto trampoline = reinterpret_cast<void (*)(JitContext*, uint8_t*)>(code);
+	trampoline(&context, block->entry);
+}
+
+void Jit::link(uint8_t* exit, JitBlock* target) {
+	int32_t displacement = static_cast<int32_t>(target->entry - (exit + 5));
+	std::memcpy(exit + 1, &displacement, 4);
+}
+
+void Jit::invalidate(uint16_t address) {
+	if (address < 4096 && covered[address]) {
+		clear();
+	}
+}
+
+void Jit::clear() {
+	codeUsed = trampolineSize;
+	blocks.clear();
+
+	for (int i = 0; i < 4096; ++i) {
+		blockIndex[i] = -1;
+		covered[i] = false;
+	}
+
+	generation++;
+}
+
+bool Jit::allocate() {
+#if CHIP8_JIT_SUPPORTED
+#ifdef _WIN32
+	void* memory = VirtualAlloc(nullptr, codeBufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+	if (memory == nullptr) {
+		return false;
+	}
+#else
+	void* memory = mmap(nullptr, codeBufferSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		return false;
+	}
+#endif
+	code = static_cast<uint8_t*>(memory);
+	codeSize = codeBufferSize;
+
+	// one block per start address at most, so pointers into blocks stay valid
+	blocks.reserve(4096);
+
+	emitTrampoline();
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+/* saves the callee saved registers, points rbx at the context and r15 at
+V and jumps to the block. Every block leaves through the epilogue*/
+void Jit::emitTrampoline() {
+	Assembler a(code);
+
+	for (int reg : savedRegisters) {
+		a.push(reg);
+	}
+
+	a.aluImm64(EXT_SUB, RSP, frameSize);
+	a.mov64(CONTEXT, ARG0);
+	a.load64(VBASE, CONTEXT, offsetV);
+	a.jmpReg(ARG1);
+
+	epilogue = a.position();
+
+	a.aluImm64(EXT_ADD, RSP, frameSize);
+
+	for (int i = 7; i >= 0; --i) {
+		a.pop(savedRegisters[i]);
+	}
+
+	a.ret();
+
+	trampolineSize = a.size();
+	codeUsed = trampolineSize;
+}
\ No newline at end of file
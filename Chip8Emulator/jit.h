@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "instruction.h"
+
+class Emulator;
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT_SUPPORTED 1
+#else
+#define CHIP8_JIT_SUPPORTED 0
+#endif
+
+/* everything compiled code needs to reach the emulator, the offsets of
+these fields are baked into the generated code*/
+struct JitContext {
+	uint8_t* V = nullptr;
+	uint16_t* I = nullptr;
+	uint16_t* PC = nullptr;
+	uint8_t* DT = nullptr;
+	uint8_t* ST = nullptr;
+
+	// instructions that may still be executed, every block subtracts its length
+	int64_t budget = 0;
+
+	Emulator* emulator = nullptr;
+
+	// executes one instruction that has no native translation
+	void (*helper)(Emulator*, uint64_t) = nullptr;
+
+	// the patchable jump of the last exit taken, nullptr if it can not be chained
+	uint8_t* lastExit = nullptr;
+};
+
+struct JitBlock {
+	uint16_t start = 0;
+
+	// address one past the last byte of the block
+	uint16_t end = 0;
+
+	uint32_t length = 0;
+	uint8_t* entry = nullptr;
+};
+
+/* translates basic blocks to x86-64 code. V registers and I are kept in
+host registers for the whole block, PC is known at compile time and only
+written when leaving the block. Exits to a constant address are patched
+to jump straight into the next block once it has been compiled*/
+class Jit {
+public:
+	Jit();
+	~Jit();
+
+	Jit(const Jit&) = delete;
+	Jit& operator=(const Jit&) = delete;
+
+	// false on hosts where no code can be generated
+	static bool isSupported();
+
+	// returns nullptr if there is no compiled block starting at address
+	JitBlock* find(uint16_t address);
+
+	/* compiles the block starting at address, returns nullptr if the first
+	instruction has to be run by the interpreter (unknown opcodes and Fx0A)*/
+	JitBlock* compile(uint16_t address, const uint8_t* memory);
+
+	// runs compiled code starting at block until it returns to the caller
+	void enter(JitContext& context, JitBlock* block);
+
+	// makes the exit stored in context.lastExit jump straight to target
+	void link(uint8_t* exit, JitBlock* target);
+
+	// drops all compiled code if the byte at address is part of a block
+	void invalidate(uint16_t address);
+
+	void clear();
+
+	/* incremented every time compiled code is thrown away, exits taken
+	before that can not be linked anymore*/
+	uint64_t generation = 0;
+
+private:
+	uint8_t* code = nullptr;
+	size_t codeSize = 0;
+	size_t codeUsed = 0;
+
+	// end of the shared prologue that every entry goes through
+	size_t trampolineSize = 0;
+	uint8_t* epilogue = nullptr;
+
+	std::vector<JitBlock> blocks;
+	int32_t blockIndex[4096];
+	bool covered[4096];
+
+	bool allocate();
+	void emitTrampoline();
+};
\ No newline at end of file
@@ -0,0 +1,687 @@
+#include "lockstep.h"
+#include <cstring>
+
+#ifdef _MSC_VER
+#define CHIP8_FORCE_INLINE __forceinline
+#else
+#define CHIP8_FORCE_INLINE __attribute__((always_inline)) inline
+#endif
+
+/* the AVX2 and AVX-512 versions are execute<laneBlock> inlined into a function
+compiled for that instruction set. MSVC only vectorizes for the /arch it was
+given, so there it is always the baseline*/
+#if CHIP8_SIMD_SUPPORTED && (defined(__GNUC__) || defined(__clang__))
+#define CHIP8_LOCKSTEP_TARGETS 1
+#define CHIP8_TARGET_AVX2 __attribute__((target("avx2")))
+#if defined(__clang__)
+#define CHIP8_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+// GCC keeps to 256 bit vectors unless it is told otherwise
+#define CHIP8_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,prefer-vector-width=512")))
+#endif
+#else
+#define CHIP8_LOCKSTEP_TARGETS 0
+#endif
+
+namespace {
+	// a lane mask widened to 16 bits
+	CHIP8_FORCE_INLINE uint16_t wide(uint8_t mask) {
+		return static_cast<uint16_t>(static_cast<int16_t>(static_cast<int8_t>(mask)));
+	}
+
+	// value for lanes in mask, old for the others
+	CHIP8_FORCE_INLINE uint8_t blend(uint8_t old, uint8_t value, uint8_t mask) {
+		return static_cast<uint8_t>((value & mask) | (old & ~mask));
+	}
+
+	CHIP8_FORCE_INLINE uint16_t blend(uint16_t old, uint16_t value, uint8_t mask) {
+		return static_cast<uint16_t>((value & wide(mask)) | (old & ~wide(mask)));
+	}
+
+	// groups of fewer lanes are executed lane by lane
+	const int minimumBlockGroup = 4;
+
+	/* 8xy4 to 8xyE on copies of the lanes, op is a template parameter so that
+	every loop is a single operation the compiler can vectorize*/
+	template <int width, Op op>
+	CHIP8_FORCE_INLINE void arithmetic(const Instruction& in, const uint8_t* x, const uint8_t* y, const uint8_t* f,
+		uint8_t* vx, uint8_t* vf, const uint8_t* m) {
+		uint8_t flag[width], a[width], b[width], result[width];
+
+		for (int l = 0; l < width; ++l) {
+			if constexpr (op == Op::ADD_REG) {
+				flag[l] = static_cast<uint8_t>(x[l] + y[l]) < x[l] ? 1 : 0;
+			}
+			else if constexpr (op == Op::SUB) {
+				flag[l] = x[l] >= y[l] ? 1 : 0;
+			}
+			else if constexpr (op == Op::SHR) {
+				flag[l] = x[l] & 0x01;
+			}
+			else if constexpr (op == Op::SUBN) {
+				flag[l] = x[l] >= y[l] ? 0 : 1;
+			}
+			else {
+				flag[l] = x[l] >> 7;
+			}
+		}
+
+		/* like Emulator::execute only the sum is computed before VF is written,
+		everything else reads a Vx or Vy that is VF after it*/
+		bool late = op != Op::ADD_REG;
+		std::memcpy(a, late && in.x == 15 ? flag : x, width);
+		std::memcpy(b, late && in.y == 15 ? flag : y, width);
+
+		for (int l = 0; l < width; ++l) {
+			if constexpr (op == Op::ADD_REG) {
+				result[l] = static_cast<uint8_t>(a[l] + b[l]);
+			}
+			else if constexpr (op == Op::SUB) {
+				result[l] = static_cast<uint8_t>(a[l] - b[l]);
+			}
+			else if constexpr (op == Op::SHR) {
+				result[l] = a[l] >> 1;
+			}
+			else if constexpr (op == Op::SUBN) {
+				result[l] = static_cast<uint8_t>(b[l] - a[l]);
+			}
+			else {
+				result[l] = static_cast<uint8_t>(a[l] << 1);
+			}
+		}
+
+		// VF first, if x is 15 the result is what is left in it
+		for (int l = 0; l < width; ++l) {
+			vf[l] = blend(f[l], flag[l], m[l]);
+		}
+		for (int l = 0; l < width; ++l) {
+			vx[l] = blend(x[l], result[l], m[l]);
+		}
+	}
+}
+
+LockstepEmulator::LockstepEmulator(const uint8_t* program, int programLength, int lanes) :
+	lanes(lanes), stride((lanes + laneBlock - 1) / laneBlock * laneBlock) {
+	for (int i = 0; i < 16; ++i) {
+		V[i] = new uint8_t[stride]();
+		keyboard[i] = new uint8_t[stride]();
+	}
+	for (int i = 0; i <= Machine::stackMask; ++i) {
+		stack[i] = new uint16_t[stride]();
+	}
+
+	PC = new uint16_t[stride]();
+	I = new uint16_t[stride]();
+	SP = new uint16_t[stride]();
+	DT = new uint8_t[stride]();
+	ST = new uint8_t[stride]();
+	randomState = new uint64_t[stride]();
+	memory = new uint8_t[static_cast<size_t>(stride) * memoryStride]();
+	display = new uint64_t[static_cast<size_t>(stride) * Machine::displayY]();
+	running = new uint8_t[stride]();
+	waitingForKey = new uint8_t[stride]();
+	pendingKey = new uint8_t[stride]();
+
+	Machine initial;
+	loadProgram(initial, program, programLength);
+
+	// the padding lanes are never running
+	for (int lane = 0; lane < lanes; ++lane) {
+		initial.randomState = randomStateFromSeed(lane);
+		restore(lane, initial);
+	}
+
+	// every lane has the same memory again
+	for (int i = 0; i < 4096; ++i) {
+		written[i] = false;
+	}
+
+	executeBlock = selectBlockFunction();
+}
+
+LockstepEmulator::~LockstepEmulator() {
+	for (int i = 0; i < 16; ++i) {
+		delete[] V[i];
+		delete[] keyboard[i];
+	}
+	for (int i = 0; i <= Machine::stackMask; ++i) {
+		delete[] stack[i];
+	}
+
+	delete[] PC;
+	delete[] I;
+	delete[] SP;
+	delete[] DT;
+	delete[] ST;
+	delete[] randomState;
+	delete[] memory;
+	delete[] display;
+	delete[] running;
+	delete[] waitingForKey;
+	delete[] pendingKey;
+}
+
+template <int width>
+CHIP8_FORCE_INLINE void LockstepEmulator::execute(const Instruction& in, int first, const uint8_t* mask) {
+	uint8_t* vx = V[in.x] + first;
+	uint8_t* vy = V[in.y] + first;
+	uint8_t* vf = V[15] + first;
+	uint16_t* pc = PC + first;
+
+	/* the lanes are copied first, the loops below only store and the compiler
+	does not have to check whether x, y and VF are the same register*/
+	uint8_t m[width], x[width], y[width], f[width];
+	uint16_t next[width];
+
+	for (int l = 0; l < width; ++l) {
+		m[l] = mask[l];
+		x[l] = vx[l];
+		y[l] = vy[l];
+		f[l] = vf[l];
+
+		// the PC of most instructions
+		next[l] = static_cast<uint16_t>(pc[l] + 2);
+	}
+
+	switch (in.op) {
+	case Op::CLS:
+		for (int l = 0; l < width; ++l) {
+			if (m[l] != 0) {
+				std::memset(laneDisplay(first + l), 0, Machine::displayY * sizeof(uint64_t));
+			}
+		}
+		break;
+
+	case Op::RET:
+		for (int l = 0; l < width; ++l) {
+			if (m[l] != 0) {
+				int lane = first + l;
+				next[l] = static_cast<uint16_t>(stack[SP[lane]][lane] + 2);
+				SP[lane] = (SP[lane] - 1) & Machine::stackMask;
+			}
+		}
+		break;
+
+	case Op::JP:
+		for (int l = 0; l < width; ++l) {
+			next[l] = in.nnn;
+		}
+		break;
+
+	case Op::CALL:
+		for (int l = 0; l < width; ++l) {
+			if (m[l] != 0) {
+				int lane = first + l;
+				SP[lane] = (SP[lane] + 1) & Machine::stackMask;
+				stack[SP[lane]][lane] = pc[l];
+			}
+			next[l] = in.nnn;
+		}
+		break;
+
+	case Op::SE_BYTE:
+		for (int l = 0; l < width; ++l) {
+			next[l] = static_cast<uint16_t>(pc[l] + (x[l] == in.kk ? 4 : 2));
+		}
+		break;
+
+	case Op::SNE_BYTE:
+		for (int l = 0; l < width; ++l) {
+			next[l] = static_cast<uint16_t>(pc[l] + (x[l] != in.kk ? 4 : 2));
+		}
+		break;
+
+	case Op::SE_REG:
+		for (int l = 0; l < width; ++l) {
+			next[l] = static_cast<uint16_t>(pc[l] + (x[l] == y[l] ? 4 : 2));
+		}
+		break;
+
+	case Op::SNE_REG:
+		for (int l = 0; l < width; ++l) {
+			next[l] = static_cast<uint16_t>(pc[l] + (x[l] != y[l] ? 4 : 2));
+		}
+		break;
+
+	case Op::LD_BYTE:
+		for (int l = 0; l < width; ++l) {
+			vx[l] = blend(x[l], in.kk, m[l]);
+		}
+		break;
+
+	case Op::ADD_BYTE:
+		for (int l = 0; l < width; ++l) {
+			vx[l] = blend(x[l], static_cast<uint8_t>(x[l] + in.kk), m[l]);
+		}
+		break;
+
+	case Op::LD_REG:
+		for (int l = 0; l < width; ++l) {
+			vx[l] = blend(x[l], y[l], m[l]);
+		}
+		break;
+
+	case Op::OR:
+		for (int l = 0; l < width; ++l) {
+			vx[l] = blend(x[l], static_cast<uint8_t>(x[l] | y[l]), m[l]);
+		}
+		break;
+
+	case Op::AND:
+		for (int l = 0; l < width; ++l) {
+			vx[l] = blend(x[l], static_cast<uint8_t>(x[l] & y[l]), m[l]);
+		}
+		break;
+
+	case Op::XOR:
+		for (int l = 0; l < width; ++l) {
+			vx[l] = blend(x[l], static_cast<uint8_t>(x[l] ^ y[l]), m[l]);
+		}
+		break;
+
+	case Op::ADD_REG:
+		arithmetic<width, Op::ADD_REG>(in, x, y, f, vx, vf, m);
+		break;
+
+	case Op::SUB:
+		arithmetic<width, Op::SUB>(in, x, y, f, vx, vf, m);
+		break;
+
+	case Op::SHR:
+		arithmetic<width, Op::SHR>(in, x, y, f, vx, vf, m);
+		break;
+
+	case Op::SUBN:
+		arithmetic<width, Op::SUBN>(in, x, y, f, vx, vf, m);
+		break;
+
+	case Op::SHL:
+		arithmetic<width, Op::SHL>(in, x, y, f, vx, vf, m);
+		break;
+
+	case Op::LD_I:
+		for (int l = 0; l < width; ++l) {
+			I[first + l] = blend(I[first + l], in.nnn, m[l]);
+		}
+		break;
+
+	case Op::JP_V0: {
+		const uint8_t* v0 = V[0] + first;
+
+		for (int l = 0; l < width; ++l) {
+			next[l] = static_cast<uint16_t>(in.nnn + v0[l]);
+		}
+		break;
+	}
+
+	case Op::RND:
+		for (int l = 0; l < width; ++l) {
+			if (m[l] != 0) {
+				vx[l] = in.kk & nextRandom(first + l);
+			}
+		}
+		break;
+
+	case Op::DRW:
+		for (int l = 0; l < width; ++l) {
+			if (m[l] != 0) {
+				int lane = first + l;
+				const uint8_t* sprite = laneMemory(lane) + (I[lane] & Machine::addressMask);
+
+				// the position is read before VF is cleared
+				int column = x[l] % Machine::displayX, row = y[l] % Machine::displayY;
+				vf[l] = blitSprite(laneDisplay(lane), sprite, in.n, column, row, true) != 0 ? 1 : 0;
+			}
+		}
+		break;
+
+	case Op::SKP:
+	case Op::SKNP:
+		// only the low 4 bits of V[x] name a key, like in Emulator
+		for (int l = 0; l < width; ++l) {
+			bool pressed = keyboard[x[l] & 0x0F][first + l] == 1;
+			next[l] = static_cast<uint16_t>(pc[l] + (pressed == (in.op == Op::SKP) ? 4 : 2));
+		}
+		break;
+
+	case Op::LD_VX_DT:
+		for (int l = 0; l < width; ++l) {
+			vx[l] = blend(x[l], DT[first + l], m[l]);
+		}
+		break;
+
+	case Op::LD_VX_K:
+		for (int l = 0; l < width; ++l) {
+			if (m[l] != 0) {
+				int lane = first + l;
+
+				// only keys pressed after this instruction started count
+				if (waitingForKey[lane] == 0) {
+					waitingForKey[lane] = 1;
+					pendingKey[lane] = noKey;
+				}
+
+				// PC stays so this instruction runs again next cycle
+				if (pendingKey[lane] == noKey) {
+					next[l] = pc[l];
+				}
+				else {
+					waitingForKey[lane] = 0;
+					vx[l] = pendingKey[lane];
+				}
+			}
+		}
+		break;
+
+	case Op::LD_DT_VX:
+		for (int l = 0; l < width; ++l) {
+			DT[first + l] = blend(DT[first + l], x[l], m[l]);
+		}
+		break;
+
+	case Op::LD_ST_VX:
+		for (int l = 0; l < width; ++l) {
+			ST[first + l] = blend(ST[first + l], x[l], m[l]);
+		}
+		break;
+
+	case Op::ADD_I_VX:
+		for (int l = 0; l < width; ++l) {
+			I[first + l] = static_cast<uint16_t>(I[first + l] + (x[l] & m[l]));
+		}
+		break;
+
+	case Op::LD_F_VX:
+		for (int l = 0; l < width; ++l) {
+			I[first + l] = blend(I[first + l], static_cast<uint16_t>(5 * x[l]), m[l]);
+		}
+		break;
+
+	case Op::LD_B_VX:
+		for (int l = 0; l < width; ++l) {
+			if (m[l] != 0) {
+				int lane = first + l;
+				writeMemory(lane, I[lane], x[l] / 100);
+				writeMemory(lane, I[lane] + 1, (x[l] % 100) / 10);
+				writeMemory(lane, I[lane] + 2, x[l] % 10);
+			}
+		}
+		break;
+
+	case Op::LD_I_VX:
+		for (int l = 0; l < width; ++l) {
+			if (m[l] != 0) {
+				int lane = first + l;
+				for (int i = 0; i <= in.x; ++i) {
+					writeMemory(lane, I[lane] + i, V[i][lane]);
+				}
+			}
+		}
+		break;
+
+	case Op::LD_VX_I:
+		for (int l = 0; l < width; ++l) {
+			if (m[l] != 0) {
+				int lane = first + l;
+				const uint8_t* source = laneMemory(lane);
+				for (int i = 0; i <= in.x; ++i) {
+					V[i][lane] = source[(I[lane] + i) & Machine::addressMask];
+				}
+			}
+		}
+		break;
+
+	default:
+		// an unknown opcode stops its lanes, the PC stays on it like in Emulator
+		for (int l = 0; l < width; ++l) {
+			running[first + l] &= ~m[l];
+			next[l] = pc[l];
+		}
+		break;
+	}
+
+	for (int l = 0; l < width; ++l) {
+		pc[l] = blend(pc[l], next[l], m[l]);
+	}
+}
+
+void LockstepEmulator::executeBlockBaseline(LockstepEmulator& emulator, const Instruction& in, int first, const uint8_t* mask) {
+	emulator.execute<laneBlock>(in, first, mask);
+}
+
+#if CHIP8_LOCKSTEP_TARGETS
+CHIP8_TARGET_AVX2 void LockstepEmulator::executeBlockAvx2(LockstepEmulator& emulator, const Instruction& in, int first, const uint8_t* mask) {
+	emulator.execute<laneBlock>(in, first, mask);
+}
+
+CHIP8_TARGET_AVX512 void LockstepEmulator::executeBlockAvx512(LockstepEmulator& emulator, const Instruction& in, int first, const uint8_t* mask) {
+	emulator.execute<laneBlock>(in, first, mask);
+}
+#endif
+
+LockstepEmulator::BlockFunction LockstepEmulator::selectBlockFunction() {
+#if CHIP8_LOCKSTEP_TARGETS
+	if (hostSupportsAvx512()) {
+		return &executeBlockAvx512;
+	}
+	if (hostSupportsAvx2()) {
+		return &executeBlockAvx2;
+	}
+#endif
+	return &executeBlockBaseline;
+}
+
+bool LockstepEmulator::step() {
+	bool ran = false;
+
+	for (int block = 0; block < stride; block += laneBlock) {
+		// copies, so that the compiler knows PC and the masks do not overlap
+		uint16_t pc[laneBlock];
+		uint8_t pending[laneBlock];
+		int count = 0;
+
+		std::memcpy(pc, PC + block, sizeof(pc));
+		std::memcpy(pending, running + block, sizeof(pending));
+
+		for (int l = 0; l < laneBlock; ++l) {
+			// like Emulator::fetch
+			pc[l] &= Machine::addressMask;
+			count += pending[l] & 1;
+		}
+
+		std::memcpy(PC + block, pc, sizeof(pc));
+
+		ran |= count != 0;
+
+		while (count != 0) {
+			int leader = 0;
+			while (pending[leader] == 0) {
+				++leader;
+			}
+
+			uint16_t address = pc[leader];
+			const uint8_t* code = laneMemory(block + leader) + address;
+			uint16_t opcode = static_cast<uint16_t>(code[0] << 8 | code[1]);
+
+			// in two steps, the compare is on 16 bits and the group on 8
+			uint8_t same[laneBlock], group[laneBlock];
+			for (int l = 0; l < laneBlock; ++l) {
+				same[l] = pc[l] == address ? 1 : 0;
+			}
+			for (int l = 0; l < laneBlock; ++l) {
+				group[l] = pending[l] & static_cast<uint8_t>(-same[l]);
+			}
+
+			// a lane may have written something else over the instruction
+			if (written[address] || written[(address + 1) & Machine::addressMask]) {
+				for (int l = 0; l < laneBlock; ++l) {
+					const uint8_t* other = laneMemory(block + l) + address;
+
+					if (group[l] != 0 && static_cast<uint16_t>(other[0] << 8 | other[1]) != opcode) {
+						group[l] = 0;
+					}
+				}
+			}
+
+			int size = 0;
+			for (int l = 0; l < laneBlock; ++l) {
+				pending[l] &= ~group[l];
+				size += group[l] & 1;
+			}
+
+			count -= size;
+			groups++;
+
+			Instruction in = decode(opcode);
+
+			if (size >= minimumBlockGroup) {
+				executeBlock(*this, in, block, group);
+			}
+			else {
+				const uint8_t all = 0xFF;
+
+				for (int l = 0; l < laneBlock; ++l) {
+					if (group[l] != 0) {
+						execute<1>(in, block + l, &all);
+					}
+				}
+			}
+		}
+	}
+
+	return ran;
+}
+
+uint64_t LockstepEmulator::runCycles(uint64_t n) {
+	uint64_t executed = 0;
+
+	for (; executed < n; ++executed) {
+		if (!step()) {
+			break;
+		}
+
+		// the same as Emulator::runCycles with cyclesPerTick
+		if (cyclesPerTick != 0) {
+			if (cyclesUntilTick == 0 || cyclesUntilTick > cyclesPerTick) {
+				cyclesUntilTick = cyclesPerTick;
+			}
+			if (--cyclesUntilTick == 0) {
+				tickTimers();
+			}
+		}
+	}
+
+	cycles += executed;
+
+	return executed;
+}
+
+void LockstepEmulator::tickTimers() {
+	for (int block = 0; block < stride; block += laneBlock) {
+		uint8_t* delay = DT + block;
+		uint8_t* sound = ST + block;
+		const uint8_t* mask = running + block;
+
+		// a stopped lane keeps its timers like a stopped Emulator
+		for (int l = 0; l < laneBlock; ++l) {
+			delay[l] -= delay[l] != 0 ? mask[l] & 1 : 0;
+			sound[l] -= sound[l] != 0 ? mask[l] & 1 : 0;
+		}
+	}
+}
+
+bool LockstepEmulator::isRunning(int lane) const {
+	return running[lane] != 0;
+}
+
+void LockstepEmulator::keyPressed(int lane, uint8_t key) {
+	if (waitingForKey[lane] != 0 && pendingKey[lane] == noKey) {
+		pendingKey[lane] = key;
+	}
+}
+
+void LockstepEmulator::seedRandom(int lane, uint64_t seed) {
+	randomState[lane] = randomStateFromSeed(seed);
+}
+
+uint8_t LockstepEmulator::nextRandom(int lane) {
+	return nextRandomByte(randomState[lane]);
+}
+
+uint8_t* LockstepEmulator::laneMemory(int lane) {
+	return memory + static_cast<size_t>(lane) * memoryStride;
+}
+
+uint64_t* LockstepEmulator::laneDisplay(int lane) {
+	return display + static_cast<size_t>(lane) * Machine::displayY;
+}
+
+void LockstepEmulator::writeMemory(int lane, uint16_t address, uint8_t value) {
+	address &= Machine::addressMask;
+
+	uint8_t* target = laneMemory(lane);
+	target[address] = value;
+
+	if (address < Machine::memoryPadding) {
+		target[4096 + address] = value;
+	}
+
+	written[address] = true;
+}
+
+Machine LockstepEmulator::snapshot(int lane) const {
+	Machine state;
+
+	state.PC = PC[lane];
+	state.SP = SP[lane];
+	state.I = I[lane];
+	state.DT = DT[lane];
+	state.ST = ST[lane];
+	state.randomState = randomState[lane];
+
+	for (int i = 0; i < 16; ++i) {
+		state.V[i] = V[i][lane];
+		state.keyboard[i] = keyboard[i][lane];
+	}
+	for (int i = 0; i <= Machine::stackMask; ++i) {
+		state.stack[i] = stack[i][lane];
+	}
+
+	std::memcpy(state.memory, memory + static_cast<size_t>(lane) * memoryStride, memoryStride);
+	std::memcpy(state.display, display + static_cast<size_t>(lane) * Machine::displayY, sizeof(state.display));
+
+	return state;
+}
+
+void LockstepEmulator::restore(int lane, const Machine& state) {
+	uint8_t* target = laneMemory(lane);
+
+	// the other lanes still have what this one had
+	for (int i = 0; i < 4096; ++i) {
+		if (target[i] != state.memory[i]) {
+			written[i] = true;
+		}
+	}
+
+	std::memcpy(target, state.memory, memoryStride);
+	std::memcpy(laneDisplay(lane), state.display, sizeof(state.display));
+
+	PC[lane] = state.PC;
+	SP[lane] = state.SP;
+	I[lane] = state.I;
+	DT[lane] = state.DT;
+	ST[lane] = state.ST;
+	randomState[lane] = state.randomState;
+
+	for (int i = 0; i < 16; ++i) {
+		V[i][lane] = state.V[i];
+		keyboard[i][lane] = state.keyboard[i];
+	}
+	for (int i = 0; i <= Machine::stackMask; ++i) {
+		stack[i][lane] = state.stack[i];
+	}
+
+	running[lane] = 0xFF;
+	waitingForKey[lane] = 0;
+	pendingKey[lane] = noKey;
+}
\ No newline at end of file
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include "machine.h"
+#include "instruction.h"
+#include "spriteBlit.h"
+
+/* many copies (lanes) of the same program run in lockstep, e.g. one per
+environment of a reinforcement learning run. The state is stored as
+structure of arrays, V[x][lane], PC[lane] and so on, so an instruction that
+every lane of a block is at is fetched and decoded once and executed for
+the whole block with one loop per register, which the compiler turns into
+SIMD code. Lanes whose PC differ are executed group by group, a group of a
+few lanes runs lane by lane.
+
+Every lane behaves like an Emulator with the modern quirks and cyclesPerTick
+timers, memory, display and keyboard are per lane. An unknown opcode only
+stops its own lane*/
+class LockstepEmulator {
+public:
+	/* lanes are processed in blocks of this many, the arrays are padded to
+	a multiple of it. 64 bytes is one AVX-512 register or two AVX2 ones*/
+	static const int laneBlock = 64;
+
+	static const int memoryStride = 4096 + Machine::memoryPadding;
+
+	// the number of lanes, and the length of every per lane array with the padding
+	const int lanes;
+	const int stride;
+
+	// registers, V[x][lane]
+	uint8_t* V[16];
+	uint16_t* PC;
+	uint16_t* I;
+	uint16_t* SP;
+	uint8_t* DT;
+	uint8_t* ST;
+	uint16_t* stack[Machine::stackMask + 1];
+	uint64_t* randomState;
+
+	// keyboard[key][lane], 1 means pressed
+	uint8_t* keyboard[16];
+
+	/* memoryStride bytes per lane, lane after lane. The first bytes are
+	mirrored after the end like in Machine*/
+	uint8_t* memory;
+
+	// Machine::displayY rows per lane, lane after lane, see Machine::display
+	uint64_t* display;
+
+	// see Emulator::cyclesPerTick, 0 means tickTimers is called from outside
+	uint64_t cyclesPerTick = 0;
+
+	// instructions executed by every running lane since the emulator was created
+	uint64_t cycles = 0;
+
+	// groups of lanes an instruction was executed for, a measure of how much the lanes diverge
+	uint64_t groups = 0;
+
+	// every lane starts with the program loaded, Cxkk of lane l is seeded with l
+	LockstepEmulator(const uint8_t* program, int programLength, int lanes);
+	~LockstepEmulator();
+
+	LockstepEmulator(const LockstepEmulator&) = delete;
+	LockstepEmulator& operator=(const LockstepEmulator&) = delete;
+
+	/* executes n instructions on every running lane and returns n, or less
+	if every lane has stopped*/
+	uint64_t runCycles(uint64_t n);
+
+	// decrements DT and ST of every running lane
+	void tickTimers();
+
+	// false once the lane has run into an unknown opcode
+	bool isRunning(int lane) const;
+
+	// see Emulator::keyPressed, only one key is kept while Fx0A waits
+	void keyPressed(int lane, uint8_t key);
+
+	// see Emulator::seedRandom
+	void seedRandom(int lane, uint64_t seed);
+
+	// the state of one lane as a Machine
+	Machine snapshot(int lane) const;
+
+	/* replaces the state of one lane, e.g. with the initial state to reset
+	it, and lets it run again if it had stopped*/
+	void restore(int lane, const Machine& state);
+
+	uint8_t* laneMemory(int lane);
+	uint64_t* laneDisplay(int lane);
+
+private:
+	// 0xFF for lanes that run, 0 for stopped lanes and the padding
+	uint8_t* running;
+
+	// the key of Fx0A per lane, noKey if none has been pressed since it started waiting
+	uint8_t* waitingForKey;
+	uint8_t* pendingKey;
+	static const uint8_t noKey = 0xFF;
+
+	/* true for addresses any lane has written to since the start. Everywhere
+	else memory is the same in every lane, so the opcode of a whole group can
+	be read from one lane*/
+	bool written[4096];
+
+	uint64_t cyclesUntilTick = 0;
+
+	SpriteBlitFunction blitSprite = selectSpriteBlit();
+
+	// executes one instruction on every running lane, false if none is running
+	bool step();
+
+	/* executes in for the lanes first to first + width - 1 whose mask is
+	0xFF, width is laneBlock or 1*/
+	template <int width>
+	void execute(const Instruction& in, int first, const uint8_t* mask);
+
+	using BlockFunction = void (*)(LockstepEmulator&, const Instruction&, int first, const uint8_t* mask);
+
+	// execute<laneBlock> compiled for the best instruction set of the host
+	BlockFunction executeBlock;
+
+	static void executeBlockBaseline(LockstepEmulator& emulator, const Instruction& in, int first, const uint8_t* mask);
+	static void executeBlockAvx2(LockstepEmulator& emulator, const Instruction& in, int first, const uint8_t* mask);
+	static void executeBlockAvx512(LockstepEmulator& emulator, const Instruction& in, int first, const uint8_t* mask);
+	static BlockFunction selectBlockFunction();
+
+	void writeMemory(int lane, uint16_t address, uint8_t value);
+	uint8_t nextRandom(int lane);
+};
\ No newline at end of file
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+/* the whole state of one CHIP-8 machine in a single block of memory. It is
+trivially copyable so a snapshot or a clone is one memcpy, and the registers
+every instruction uses share the first cache line*/
+struct alignas(64) Machine {
+	static const int displayX = 64, displayY = 32;
+
+	// guest addresses have 12 bits, every access is masked so it stays in memory
+	static const uint16_t addressMask = 0x0FFF;
+
+	/* the first bytes of memory are mirrored after the end, so reads that
+	start near 0xFFF (a sprite or an instruction) wrap around without a check*/
+	static const int memoryPadding = 16;
+
+	// SP wraps around instead of leaving the stack
+	static const uint16_t stackMask = 15;
+
+	/*program counter and stack pointer registers
+	program counter is set to 512 as most chip 8
+	programs start at memory location 512 */
+	uint16_t PC = 512, SP = 0;
+
+	uint16_t I = 0;
+
+	/*delay time register and sound time register,
+	both these registers are decremented at 60Hz*/
+	uint8_t DT = 0, ST = 0;
+
+	uint8_t V[16] = {};
+
+	// state of the generator used by Cxkk, see Emulator::seedRandom
+	uint64_t randomState = 1;
+
+	// 1 means pressed 0 means not pressed
+	uint8_t keyboard[16] = {};
+
+	uint16_t stack[stackMask + 1] = {};
+
+	uint8_t memory[4096 + memoryPadding] = {};
+
+	/* one 64 bit word per row, the pixel at x is bit 63 - x of display[y]
+	and a set bit means the pixel is on*/
+	uint64_t display[displayY] = {};
+};
+
+static_assert(std::is_trivially_copyable<Machine>::value, "Machine has to be copyable with memcpy");
+
+// the sprites of the hexadecimal digits, every engine stores them at address 0 (see Fx29)
+inline constexpr uint8_t fontSprites[80] = { 0xF0, 0x90, 0x90, 0x90, 0xF0,
+	0x20, 0x60, 0x20, 0x20, 0x70,
+	0xF0, 0x10, 0xF0, 0x80, 0xF0,
+	0xF0, 0x10, 0xF0, 0x10, 0xF0,
+	0x90, 0x90, 0xF0, 0x10, 0x10,
+	0xF0, 0x80, 0xF0, 0x10, 0xF0,
+	0xF0, 0x80, 0xF0, 0x90, 0xF0,
+	0xF0, 0x10, 0x20, 0x40, 0x40,
+	0xF0, 0x90, 0xF0, 0x90, 0xF0,
+	0xF0, 0x90, 0xF0, 0x10, 0xF0,
+	0xF0, 0x90, 0xF0, 0x90, 0x90,
+	0xE0, 0x90, 0xE0, 0x90, 0xE0,
+	0xF0, 0x80, 0x80, 0x80, 0xF0,
+	0xE0, 0x90, 0x90, 0x90, 0xE0,
+	0xF0, 0x80, 0xF0, 0x80, 0xF0,
+	0xF0, 0x80, 0xF0, 0x80, 0x80 };
+
+/* loads program at 0x200 and the font at 0 into a machine that has just been
+created, memory has to be all zeros*/
+inline void loadProgram(Machine& machine, const uint8_t* program, int programLength) {
+	for (int i = 0; i < programLength; ++i) {
+		machine.memory[i + 512] = program[i];
+	}
+
+	for (int i = 0; i < 80; ++i) {
+		machine.memory[i] = fontSprites[i];
+	}
+
+	for (int i = 0; i < Machine::memoryPadding; ++i) {
+		machine.memory[4096 + i] = machine.memory[i];
+	}
+}
+
+// Machine::randomState for seed, the same seed always gives the same sequence
+inline uint64_t randomStateFromSeed(uint64_t seed) {
+	// one step of splitmix64 so that similar seeds give unrelated sequences
+	uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	z ^= z >> 31;
+
+	// xorshift never leaves the all zero state
+	return z != 0 ? z : 1;
+}
+
+// the next byte of the Cxkk generator
+inline uint8_t nextRandomByte(uint64_t& state) {
+	// xorshift64*, the top bits are the best ones
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+
+	return static_cast<uint8_t>((state * 0x2545F4914F6CDD1Dull) >> 56);
+}
\ No newline at end of file
@@ -1,7 +1,10 @@
 #include "emulator.h"
+#include "chip8IO.h"
+#include "recompiler.h"
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstdlib>
 
 //#define PRINT_PROGRAM
 
@@ -71,7 +74,79 @@ int main(int argc, char* argv[]) {
     }
 #endif
 
-	Emulator e = Emulator(program, programSize);
+	Emulator e(program, programSize);
     delete[] program;
-	e.startEmulator();
+
+    // options after the file path
+    for (int i = 2; i < argc; ++i) {
+        std::string option = argv[i];
+
+        if (option == "--blocks") {
+            e.executionMode = ExecutionMode::BLOCK_CACHE;
+        }
+        else if (option == "--jit") {
+            e.executionMode = ExecutionMode::JIT;
+        }
+        else if (option == "--ir") {
+            e.executionMode = ExecutionMode::IR;
+        }
+        else if (option == "--ipf" && i + 1 < argc) {
+            // instructions per 60Hz frame
+            int instructions = std::atoi(argv[++i]);
+            if (instructions <= 0) {
+                std::cerr << "Error: --ipf needs a positive number" << std::endl;
+                return 1;
+            }
+            e.instructionsPerFrame = instructions;
+        }
+        else if (option == "--cycles-per-tick" && i + 1 < argc) {
+            // the timers follow the instruction count instead of the clock
+            int instructions = std::atoi(argv[++i]);
+            if (instructions <= 0) {
+                std::cerr << "Error: --cycles-per-tick needs a positive number" << std::endl;
+                return 1;
+            }
+            e.cyclesPerTick = instructions;
+        }
+        else if (option == "--seed" && i + 1 < argc) {
+            // makes Cxkk return the same numbers on every run
+            e.seedRandom(std::strtoull(argv[++i], nullptr, 0));
+        }
+        else if (option == "--quirks" && i + 1 < argc) {
+            // modern, cosmac or schip, anything but modern is always interpreted
+            QuirkProfile profile;
+            if (!parseQuirkProfile(argv[++i], profile)) {
+                std::cerr << "Error: --quirks needs modern, cosmac or schip" << std::endl;
+                return 1;
+            }
+            e.setQuirkProfile(profile);
+        }
+        else if (option == "--aot" && i + 1 < argc) {
+            // a plugin built from the output of --recompile
+            std::string error;
+            if (!e.loadAot(argv[++i], error)) {
+                std::cerr << "Error: " << error << std::endl;
+                return 1;
+            }
+            e.executionMode = ExecutionMode::AOT;
+        }
+        else if (option == "--recompile" && i + 1 < argc) {
+            // writes the program as C++ source and exits without running it
+            std::ofstream source(argv[++i]);
+            if (!source.is_open()) {
+                std::cerr << "Error: Could not open file: " << argv[i] << std::endl;
+                return 1;
+            }
+
+            int blocks = recompile(e.memory, source);
+            std::cout << "Recompiled " << blocks << " blocks to " << argv[i] << std::endl;
+            return 0;
+        }
+        else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return 1;
+        }
+    }
+
+	startEmulator(e);
 }
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+
+/* the behaviours that differ between CHIP-8 implementations. A profile is
+a struct with one constexpr flag for every quirk, the interpreter is
+instantiated once per profile so none of the flags is checked at run time*/
+
+// what this emulator has always done, the JIT and the other engines only implement this one
+struct ModernQuirks {
+	// 8xy6 and 8xyE shift Vy into Vx instead of shifting Vx
+	static constexpr bool shiftVy = false;
+	// Fx55 and Fx65 leave I pointing after the last register
+	static constexpr bool incrementI = false;
+	// Bxnn jumps to xnn + Vx instead of Bnnn jumping to nnn + V0
+	static constexpr bool jumpVx = false;
+	// sprites are cut off at the edges of the screen instead of wrapping around
+	static constexpr bool clipSprites = false;
+	// 8xy1, 8xy2 and 8xy3 set VF to 0
+	static constexpr bool resetVF = false;
+};
+
+// the original COSMAC VIP interpreter
+struct CosmacQuirks {
+	static constexpr bool shiftVy = true;
+	static constexpr bool incrementI = true;
+	static constexpr bool jumpVx = false;
+	static constexpr bool clipSprites = true;
+	static constexpr bool resetVF = true;
+};
+
+// SUPER-CHIP 1.1 on the HP48
+struct SuperChipQuirks {
+	static constexpr bool shiftVy = false;
+	static constexpr bool incrementI = false;
+	static constexpr bool jumpVx = true;
+	static constexpr bool clipSprites = true;
+	static constexpr bool resetVF = false;
+};
+
+enum class QuirkProfile {
+	MODERN,
+	COSMAC,
+	SUPER_CHIP
+};
+
+// accepts "modern", "cosmac" and "schip", returns false for anything else
+inline bool parseQuirkProfile(const std::string& name, QuirkProfile& profile) {
+	if (name == "modern") {
+		profile = QuirkProfile::MODERN;
+	}
+	else if (name == "cosmac") {
+		profile = QuirkProfile::COSMAC;
+	}
+	else if (name == "schip") {
+		profile = QuirkProfile::SUPER_CHIP;
+	}
+	else {
+		return false;
+	}
+
+	return true;
+}
\ No newline at end of file
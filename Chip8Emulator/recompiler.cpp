@@ -0,0 +1,494 @@
+#include "recompiler.h"
+#include "aotPlugin.h"
+#include "instruction.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+// longest block that will be written, in instructions
+const int maxBlockLength = 64;
+
+const char* const opNames[] = {
+	"UNKNOWN",
+#define CHIP8_OP_NAME(name, opcode) #name,
+	CHIP8_OPS(CHIP8_OP_NAME)
+#undef CHIP8_OP_NAME
+};
+
+struct StaticBlock {
+	uint16_t start = 0;
+
+	// address one past the last byte of the block
+	uint16_t end = 0;
+
+	std::vector<uint16_t> opcodes;
+	std::vector<Instruction> instructions;
+};
+
+std::string hex(unsigned value, int digits) {
+	char text[16];
+	std::snprintf(text, sizeof(text), "%0*X", digits, value);
+	return text;
+}
+
+std::string address(unsigned value) {
+	return "0x" + hex(value, 3);
+}
+
+std::string v(int index) {
+	return "v" + std::to_string(index);
+}
+
+// instructions that are written as C++, everything else calls the helper
+bool isTranslated(Op op) {
+	switch (op) {
+	case Op::CLS:
+	case Op::RND:
+	case Op::DRW:
+	case Op::SKP:
+	case Op::SKNP:
+	case Op::LD_VX_K:
+	case Op::LD_B_VX:
+	case Op::LD_I_VX:
+	case Op::UNKNOWN:
+		return false;
+
+	default:
+		return true;
+	}
+}
+
+// instructions that set PC themselves
+bool setsPC(Op op) {
+	switch (op) {
+	case Op::RET:
+	case Op::JP:
+	case Op::CALL:
+	case Op::SE_BYTE:
+	case Op::SNE_BYTE:
+	case Op::SE_REG:
+	case Op::SNE_REG:
+	case Op::JP_V0:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/* decodes the block starting at address, Fx0A and unknown opcodes are
+never part of a block*/
+StaticBlock scanBlock(const uint8_t* memory, uint16_t address) {
+	StaticBlock block;
+	block.start = address;
+
+	uint16_t pc = address;
+
+	while (pc + 1 < 4096 && static_cast<int>(block.instructions.size()) < maxBlockLength) {
+		uint16_t opcode = (static_cast<uint16_t>(memory[pc]) << 8) | memory[pc + 1];
+		Instruction in = decode(opcode);
+
+		if (in.op == Op::UNKNOWN || in.op == Op::LD_VX_K) {
+			break;
+		}
+
+		block.opcodes.push_back(opcode);
+		block.instructions.push_back(in);
+		pc += 2;
+
+		if (endsBlock(in.op)) {
+			break;
+		}
+	}
+
+	block.end = pc;
+
+	return block;
+}
+
+std::vector<StaticBlock> findBlocks(const uint8_t* memory) {
+	std::vector<StaticBlock> blocks;
+	std::vector<uint16_t> pending;
+	std::vector<bool> queued(4096, false);
+
+	auto follow = [&](uint32_t target) {
+		if (target + 1 < 4096 && !queued[target]) {
+			queued[target] = true;
+			pending.push_back(static_cast<uint16_t>(target));
+		}
+	};
+
+	follow(512);
+
+	while (!pending.empty()) {
+		uint16_t start = pending.back();
+		pending.pop_back();
+
+		StaticBlock block = scanBlock(memory, start);
+		uint16_t next = block.end;
+
+		if (block.instructions.empty()) {
+			// the interpreter runs Fx0A, the code after it is still reachable
+			uint16_t opcode = (static_cast<uint16_t>(memory[start]) << 8) | memory[start + 1];
+			if (decode(opcode).op == Op::LD_VX_K) {
+				follow(start + 2);
+			}
+			continue;
+		}
+
+		const Instruction& last = block.instructions.back();
+
+		switch (last.op) {
+		case Op::JP:
+			follow(last.nnn);
+			break;
+
+		case Op::CALL:
+			// RET comes back to the instruction after the call
+			follow(last.nnn);
+			follow(next);
+			break;
+
+		case Op::SE_BYTE:
+		case Op::SNE_BYTE:
+		case Op::SE_REG:
+		case Op::SNE_REG:
+		case Op::SKP:
+		case Op::SKNP:
+			follow(next);
+			follow(next + 2);
+			break;
+
+		case Op::RET:
+		case Op::JP_V0:
+			// the target is only known at run time
+			break;
+
+		default:
+			// Fx33, Fx55 or a block that was cut short
+			follow(next);
+			break;
+		}
+
+		blocks.push_back(std::move(block));
+	}
+
+	std::sort(blocks.begin(), blocks.end(), [](const StaticBlock& a, const StaticBlock& b) {
+		return a.start < b.start;
+	});
+
+	return blocks;
+}
+
+/* writes one block as a function. The V registers the block uses and I
+are copied to locals so the compiler can keep them in registers, they are
+written back before calling the helper and when leaving the block*/
+class BlockWriter {
+public:
+	BlockWriter(std::ostream& out) : out(out) {
+	}
+
+	void write(const StaticBlock& block) {
+		findUsedRegisters(block);
+
+		out << "void block" << hex(block.start, 3) << "(AotContext& c) {\n";
+
+		loadRegisters(true);
+
+		uint16_t pc = block.start;
+		size_t count = block.instructions.size();
+
+		for (size_t i = 0; i < count; ++i, pc += 2) {
+			const Instruction& in = block.instructions[i];
+			bool isLast = i + 1 == count;
+
+			out << "\t// " << address(pc) << " " << hex(block.opcodes[i], 4)
+				<< " " << opNames[static_cast<int>(in.op)] << "\n";
+
+			if (!isTranslated(in.op)) {
+				storeRegisters();
+				out << "\t*c.PC = " << address(pc) << ";\n";
+				out << "\tc.helper(c.emulator, 0x" << hex(block.opcodes[i], 4) << ");\n";
+
+				// the helper has already moved PC past the last instruction
+				if (!isLast) {
+					loadRegisters(false);
+				}
+				continue;
+			}
+
+			if (setsPC(in.op)) {
+				storeRegisters();
+			}
+
+			writeInstruction(in, pc);
+
+			if (isLast && !setsPC(in.op)) {
+				storeRegisters();
+				out << "\t*c.PC = " << address(block.end) << ";\n";
+			}
+		}
+
+		out << "}\n\n";
+	}
+
+private:
+	std::ostream& out;
+
+	bool usedV[16];
+	bool usedI;
+
+	void findUsedRegisters(const StaticBlock& block) {
+		for (int i = 0; i < 16; ++i) {
+			usedV[i] = false;
+		}
+		usedI = false;
+
+		for (const Instruction& in : block.instructions) {
+			if (!isTranslated(in.op)) {
+				continue;
+			}
+
+			switch (in.op) {
+			case Op::RET:
+			case Op::JP:
+			case Op::CALL:
+				break;
+
+			case Op::LD_I:
+				usedI = true;
+				break;
+
+			case Op::JP_V0:
+				usedV[0] = true;
+				break;
+
+			case Op::ADD_I_VX:
+			case Op::LD_F_VX:
+				usedI = true;
+				usedV[in.x] = true;
+				break;
+
+			case Op::LD_VX_I:
+				usedI = true;
+				for (int i = 0; i <= in.x; ++i) {
+					usedV[i] = true;
+				}
+				break;
+
+			case Op::ADD_REG:
+			case Op::SUB:
+			case Op::SHR:
+			case Op::SUBN:
+			case Op::SHL:
+				usedV[in.x] = true;
+				usedV[in.y] = true;
+				usedV[15] = true;
+				break;
+
+			default:
+				// y is never looked at by the other instructions, marking it is harmless
+				usedV[in.x] = true;
+				usedV[in.y] = true;
+				break;
+			}
+		}
+	}
+
+	void loadRegisters(bool declare) {
+		for (int i = 0; i < 16; ++i) {
+			if (usedV[i]) {
+				out << "\t" << (declare ? "uint8_t " : "") << v(i) << " = c.V[" << i << "];\n";
+			}
+		}
+
+		if (usedI) {
+			out << "\t" << (declare ? "uint16_t " : "") << "i = *c.I;\n";
+		}
+	}
+
+	void storeRegisters() {
+		for (int i = 0; i < 16; ++i) {
+			if (usedV[i]) {
+				out << "\tc.V[" << i << "] = " << v(i) << ";\n";
+			}
+		}
+
+		if (usedI) {
+			out << "\t*c.I = i;\n";
+		}
+	}
+
+	void skip(const std::string& condition, uint16_t pc) {
+		out << "\t*c.PC = " << condition << " ? " << address(pc + 4u) << " : "
+			<< address(pc + 2u) << ";\n";
+	}
+
+	// the same order of reads and writes as Emulator::execute, so x == F behaves the same
+	void writeInstruction(const Instruction& in, uint16_t pc) {
+		std::string x = v(in.x), y = v(in.y), kk = std::to_string(in.kk);
+
+		switch (in.op) {
+		case Op::RET:
+			out << "\t*c.PC = static_cast<uint16_t>(c.stack[*c.SP] + 2);\n";
+			out << "\t*c.SP = (*c.SP - 1) & 15;\n";
+			break;
+
+		case Op::JP:
+			out << "\t*c.PC = " << address(in.nnn) << ";\n";
+			break;
+
+		case Op::CALL:
+			out << "\t*c.SP = (*c.SP + 1) & 15;\n";
+			out << "\tc.stack[*c.SP] = " << address(pc) << ";\n";
+			out << "\t*c.PC = " << address(in.nnn) << ";\n";
+			break;
+
+		case Op::SE_BYTE:
+			skip(x + " == " + kk, pc);
+			break;
+
+		case Op::SNE_BYTE:
+			skip(x + " != " + kk, pc);
+			break;
+
+		case Op::SE_REG:
+			skip(in.x == in.y ? "true" : x + " == " + y, pc);
+			break;
+
+		case Op::SNE_REG:
+			skip(in.x == in.y ? "false" : x + " != " + y, pc);
+			break;
+
+		case Op::LD_BYTE:
+			out << "\t" << x << " = " << kk << ";\n";
+			break;
+
+		case Op::ADD_BYTE:
+			out << "\t" << x << " = static_cast<uint8_t>(" << x << " + " << kk << ");\n";
+			break;
+
+		case Op::LD_REG:
+			out << "\t" << x << " = " << y << ";\n";
+			break;
+
+		case Op::OR:
+			out << "\t" << x << " |= " << y << ";\n";
+			break;
+
+		case Op::AND:
+			out << "\t" << x << " &= " << y << ";\n";
+			break;
+
+		case Op::XOR:
+			out << "\t" << x << " ^= " << y << ";\n";
+			break;
+
+		case Op::ADD_REG:
+			out << "\t{\n";
+			out << "\t\tunsigned sum = " << x << " + " << y << ";\n";
+			out << "\t\tv15 = sum > 0xFF ? 1 : 0;\n";
+			out << "\t\t" << x << " = static_cast<uint8_t>(sum);\n";
+			out << "\t}\n";
+			break;
+
+		case Op::SUB:
+			out << "\tv15 = " << (in.x == in.y ? "1" : x + " >= " + y + " ? 1 : 0") << ";\n";
+			out << "\t" << x << " = static_cast<uint8_t>(" << x << " - " << y << ");\n";
+			break;
+
+		case Op::SHR:
+			out << "\tv15 = " << x << " & 0x01;\n";
+			out << "\t" << x << " = static_cast<uint8_t>(" << x << " >> 1);\n";
+			break;
+
+		case Op::SUBN:
+			out << "\tv15 = " << (in.x == in.y ? "0" : x + " >= " + y + " ? 0 : 1") << ";\n";
+			out << "\t" << x << " = static_cast<uint8_t>(" << y << " - " << x << ");\n";
+			break;
+
+		case Op::SHL:
+			out << "\tv15 = (" << x << " & 0x80) != 0 ? 1 : 0;\n";
+			out << "\t" << x << " = static_cast<uint8_t>(" << x << " << 1);\n";
+			break;
+
+		case Op::LD_I:
+			out << "\ti = " << address(in.nnn) << ";\n";
+			break;
+
+		case Op::JP_V0:
+			out << "\t*c.PC = static_cast<uint16_t>(" << address(in.nnn) << " + v0);\n";
+			break;
+
+		case Op::LD_VX_DT:
+			out << "\t" << x << " = *c.DT;\n";
+			break;
+
+		case Op::LD_DT_VX:
+			out << "\t*c.DT = " << x << ";\n";
+			break;
+
+		case Op::LD_ST_VX:
+			out << "\t*c.ST = " << x << ";\n";
+			break;
+
+		case Op::ADD_I_VX:
+			out << "\ti = static_cast<uint16_t>(i + " << x << ");\n";
+			break;
+
+		case Op::LD_F_VX:
+			out << "\ti = static_cast<uint16_t>(5 * " << x << ");\n";
+			break;
+
+		case Op::LD_VX_I:
+			for (int i = 0; i <= in.x; ++i) {
+				out << "\t" << v(i) << " = c.memory[(i + " << i << ") & 0xFFF];\n";
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+};
+
+}
+
+int recompile(const uint8_t* memory, std::ostream& out) {
+	std::vector<StaticBlock> blocks = findBlocks(memory);
+
+	out << "// written by Chip8Emulator --recompile, do not edit\n";
+	out << "// build it as a shared library with the emulator sources on the include path\n";
+	out << "#include \"aotPlugin.h\"\n\n";
+	out << "namespace {\n\n";
+
+	BlockWriter writer(out);
+
+	for (const StaticBlock& block : blocks) {
+		writer.write(block);
+	}
+
+	if (!blocks.empty()) {
+		out << "const AotBlock blocks[] = {\n";
+		for (const StaticBlock& block : blocks) {
+			out << "\t{ " << address(block.start) << ", " << address(block.end) << ", "
+				<< block.instructions.size() << ", &block" << hex(block.start, 3) << " },\n";
+		}
+		out << "};\n\n";
+	}
+
+	out << "const AotModule module = { CHIP8_AOT_VERSION, 0x"
+		<< hex(static_cast<unsigned>(hashProgramMemory(memory) >> 32), 8)
+		<< hex(static_cast<unsigned>(hashProgramMemory(memory)), 8) << "ull, "
+		<< blocks.size() << ", " << (blocks.empty() ? "nullptr" : "blocks") << " };\n\n";
+	out << "}\n\n";
+
+	out << "CHIP8_AOT_EXPORT const AotModule* chip8AotModule() {\n";
+	out << "\treturn &module;\n";
+	out << "}\n";
+
+	return static_cast<int>(blocks.size());
+}
\ No newline at end of file
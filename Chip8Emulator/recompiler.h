@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+/* follows every jump, call and skip of the program in memory starting at
+0x200 and writes C++ source with one function per block that was reached.
+Built as a shared library the source can be loaded with Emulator::loadAot,
+anything that was not found here is left to the interpreter. Returns the
+number of blocks that were written*/
+int recompile(const uint8_t* memory, std::ostream& out);
\ No newline at end of file
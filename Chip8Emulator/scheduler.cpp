@@ -0,0 +1,135 @@
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+double WorkerStats::utilization() const {
+	return wallSeconds > 0 ? busySeconds / wallSeconds : 0;
+}
+
+WorkStealingScheduler::WorkStealingScheduler(unsigned threads) :
+	workers(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+}
+
+unsigned WorkStealingScheduler::workerCount() const {
+	return static_cast<unsigned>(workers.size());
+}
+
+bool WorkStealingScheduler::popOwn(unsigned worker, size_t& task) {
+	std::lock_guard<std::mutex> lock(workers[worker].mutex);
+	std::deque<size_t>& tasks = workers[worker].tasks;
+
+	if (tasks.empty()) {
+		return false;
+	}
+
+	task = tasks.back();
+	tasks.pop_back();
+
+	return true;
+}
+
+bool WorkStealingScheduler::steal(unsigned thief, size_t& task) {
+	unsigned count = workerCount();
+
+	// starting after the thief so that not every thief goes for the same victim
+	for (unsigned i = 1; i < count; ++i) {
+		Worker& victim = workers[(thief + i) % count];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+
+		if (!victim.tasks.empty()) {
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void WorkStealingScheduler::pushOwn(unsigned worker, size_t task) {
+	{
+		std::lock_guard<std::mutex> lock(workers[worker].mutex);
+		workers[worker].tasks.push_back(task);
+	}
+
+	wakeIdle();
+}
+
+void WorkStealingScheduler::wakeIdle() {
+	pushes.fetch_add(1);
+
+	// taking the lock makes sure a worker is either already waiting or sees the change
+	{
+		std::lock_guard<std::mutex> lock(idleMutex);
+	}
+	idleCondition.notify_all();
+}
+
+void WorkStealingScheduler::run(size_t taskCount, const std::function<bool(size_t)>& runSlice) {
+	unsigned count = workerCount();
+
+	stats.assign(count, WorkerStats());
+
+	// dealt out in turn, stealing evens out whatever this gets wrong
+	for (size_t i = 0; i < taskCount; ++i) {
+		workers[i % count].tasks.push_back(i);
+	}
+
+	// tasks that are not done yet, including the ones that are running
+	std::atomic<size_t> remaining{ taskCount };
+
+	auto work = [&](unsigned self) {
+		using Clock = std::chrono::steady_clock;
+		WorkerStats& own = stats[self];
+		Clock::time_point start = Clock::now();
+
+		while (remaining.load(std::memory_order_acquire) != 0) {
+			size_t task;
+
+			// read before looking for a task so that a push in between is not missed
+			uint64_t seenPushes = pushes.load();
+
+			if (!popOwn(self, task)) {
+				if (!steal(self, task)) {
+					// the last tasks are running on other workers, sleep until one is put back
+					std::unique_lock<std::mutex> lock(idleMutex);
+					idleCondition.wait(lock, [&]() {
+						return pushes.load() != seenPushes || remaining.load(std::memory_order_acquire) == 0;
+					});
+					continue;
+				}
+				own.steals++;
+			}
+
+			Clock::time_point sliceStart = Clock::now();
+			bool done = runSlice(task);
+			own.busySeconds += std::chrono::duration<double>(Clock::now() - sliceStart).count();
+			own.slices++;
+
+			if (done) {
+				if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					wakeIdle();
+				}
+			}
+			else {
+				pushOwn(self, task);
+			}
+		}
+
+		own.wallSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < count; ++i) {
+		threads.emplace_back(work, i);
+	}
+
+	// the calling thread is worker 0
+	work(0);
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
\ No newline at end of file
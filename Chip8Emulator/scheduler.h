@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// what one worker of WorkStealingScheduler did during run
+struct WorkerStats {
+	uint64_t slices = 0;
+
+	// tasks taken from the deque of another worker
+	uint64_t steals = 0;
+
+	/* time spent running slices, and the whole time run took. The rest the
+	worker was asleep waiting for a task*/
+	double busySeconds = 0;
+	double wallSeconds = 0;
+
+	// the part of the time the worker was running slices, 0 to 1
+	double utilization() const;
+};
+
+/* runs tasks that are split into time slices on a fixed number of threads.
+Every worker has a deque of its own, it runs the task at the back and puts it
+back there if it is not done, so a task tends to stay on one core while it
+is hot in the cache. A worker without tasks steals from the front of the
+deques of the others, those are the tasks that waited the longest. Long and
+short tasks can be mixed without leaving cores idle at the end*/
+class WorkStealingScheduler {
+public:
+	// the number of cores if threads is 0
+	explicit WorkStealingScheduler(unsigned threads);
+
+	/* calls runSlice(task) for the tasks 0 to taskCount - 1 until it has
+	returned true for every one of them, runSlice is called from all workers
+	at once but never for the same task at the same time. Returns when every
+	task is done*/
+	void run(size_t taskCount, const std::function<bool(size_t)>& runSlice);
+
+	unsigned workerCount() const;
+
+	// one entry per worker, filled in by run
+	std::vector<WorkerStats> stats;
+
+private:
+	// on a cache line of its own so that workers do not slow each other down
+	struct alignas(64) Worker {
+		std::mutex mutex;
+		std::deque<size_t> tasks;
+	};
+
+	std::vector<Worker> workers;
+
+	/* a worker that finds no task sleeps on idleCondition until a task is put
+	back in a deque (pushes changes) or the last task is done*/
+	std::mutex idleMutex;
+	std::condition_variable idleCondition;
+	std::atomic<uint64_t> pushes{ 0 };
+
+	// false if every deque is empty
+	bool popOwn(unsigned worker, size_t& task);
+	bool steal(unsigned thief, size_t& task);
+	void pushOwn(unsigned worker, size_t task);
+
+	// wakes the sleeping workers, after a push or when the last task is done
+	void wakeIdle();
+};
\ No newline at end of file
@@ -0,0 +1,219 @@
+#include "spriteBlit.h"
+#include <cstring>
+
+#if CHIP8_SIMD_SUPPORTED
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC compiles intrinsics for any instruction set, GCC and clang need to be told
+#if CHIP8_SIMD_SUPPORTED && (defined(__GNUC__) || defined(__clang__))
+#define CHIP8_TARGET_SSE2 __attribute__((target("sse2")))
+#define CHIP8_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CHIP8_TARGET_SSE2
+#define CHIP8_TARGET_AVX2
+#endif
+
+namespace {
+	const int rows = 32;
+
+	// a sprite byte moved to its place in a row
+	inline uint64_t spriteRow(uint8_t byte, int x, bool wrap) {
+		uint64_t row = static_cast<uint64_t>(byte) << 56;
+
+		if (wrap) {
+			return (row >> x) | (row << ((64 - x) % 64));
+		}
+		return row >> x;
+	}
+
+	// rows of the sprite that are next to each other on the display
+	struct Run {
+		int offset, length, row;
+	};
+
+	/* splits the rows of a sprite where it crosses the bottom of the
+	display, returns the number of runs*/
+	inline int spriteRuns(int n, int y, bool wrap, Run runs[2]) {
+		int first = n < rows - y ? n : rows - y;
+		runs[0] = { 0, first, y };
+
+		// a sprite has at most 15 rows so it wraps at most once
+		if (wrap && first < n) {
+			runs[1] = { first, n - first, 0 };
+			return 2;
+		}
+		return 1;
+	}
+}
+
+uint64_t blitSpriteScalar(uint64_t* display, const uint8_t* sprite, int n, int x, int y, bool wrap) {
+	uint64_t collision = 0;
+
+	Run runs[2];
+	int count = spriteRuns(n, y, wrap, runs);
+
+	for (int r = 0; r < count; ++r) {
+		int offset = runs[r].offset, length = runs[r].length, row = runs[r].row;
+		for (int i = 0; i < length; ++i) {
+			uint64_t pixels = spriteRow(sprite[offset + i], x, wrap);
+
+			collision |= display[row + i] & pixels;
+			display[row + i] ^= pixels;
+		}
+	}
+
+	return collision;
+}
+
+#if CHIP8_SIMD_SUPPORTED
+CHIP8_TARGET_SSE2
+uint64_t blitSpriteSse2(uint64_t* display, const uint8_t* sprite, int n, int x, int y, bool wrap) {
+	// shifts by 64 or more give 0, so nothing wraps around when left is 64
+	__m128i right = _mm_cvtsi32_si128(x);
+	__m128i left = _mm_cvtsi32_si128(wrap ? 64 - x : 64);
+	__m128i collisions = _mm_setzero_si128();
+
+	uint64_t collision = 0;
+
+	Run runs[2];
+	int count = spriteRuns(n, y, wrap, runs);
+
+	for (int r = 0; r < count; ++r) {
+		int offset = runs[r].offset, length = runs[r].length, row = runs[r].row;
+		int i = 0;
+
+		for (; i + 2 <= length; i += 2) {
+			__m128i bytes = _mm_set_epi32(0, sprite[offset + i + 1], 0, sprite[offset + i]);
+			__m128i sprites = _mm_slli_epi64(bytes, 56);
+			__m128i pixels = _mm_or_si128(_mm_srl_epi64(sprites, right), _mm_sll_epi64(sprites, left));
+
+			__m128i* destination = reinterpret_cast<__m128i*>(display + row + i);
+			__m128i old = _mm_loadu_si128(destination);
+
+			collisions = _mm_or_si128(collisions, _mm_and_si128(old, pixels));
+			_mm_storeu_si128(destination, _mm_xor_si128(old, pixels));
+		}
+
+		// the odd row left over
+		if (i < length) {
+			uint64_t pixels = spriteRow(sprite[offset + i], x, wrap);
+
+			collision |= display[row + i] & pixels;
+			display[row + i] ^= pixels;
+		}
+	}
+
+	uint64_t lanes[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), collisions);
+
+	return collision | lanes[0] | lanes[1];
+}
+
+CHIP8_TARGET_AVX2
+uint64_t blitSpriteAvx2(uint64_t* display, const uint8_t* sprite, int n, int x, int y, bool wrap) {
+	__m128i right = _mm_cvtsi32_si128(x);
+	__m128i left = _mm_cvtsi32_si128(wrap ? 64 - x : 64);
+	__m256i collisions = _mm256_setzero_si256();
+
+	uint64_t collision = 0;
+
+	Run runs[2];
+	int count = spriteRuns(n, y, wrap, runs);
+
+	for (int r = 0; r < count; ++r) {
+		int offset = runs[r].offset, length = runs[r].length, row = runs[r].row;
+		int i = 0;
+
+		for (; i + 4 <= length; i += 4) {
+			int32_t four;
+			std::memcpy(&four, sprite + offset + i, sizeof(four));
+
+			// one sprite byte in the top of each 64 bit lane
+			__m256i sprites = _mm256_slli_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(four)), 56);
+			__m256i pixels = _mm256_or_si256(_mm256_srl_epi64(sprites, right), _mm256_sll_epi64(sprites, left));
+
+			__m256i* destination = reinterpret_cast<__m256i*>(display + row + i);
+			__m256i old = _mm256_loadu_si256(destination);
+
+			collisions = _mm256_or_si256(collisions, _mm256_and_si256(old, pixels));
+			_mm256_storeu_si256(destination, _mm256_xor_si256(old, pixels));
+		}
+
+		for (; i < length; ++i) {
+			uint64_t pixels = spriteRow(sprite[offset + i], x, wrap);
+
+			collision |= display[row + i] & pixels;
+			display[row + i] ^= pixels;
+		}
+	}
+
+	uint64_t lanes[4];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), collisions);
+
+	return collision | lanes[0] | lanes[1] | lanes[2] | lanes[3];
+}
+
+bool hostSupportsAvx2() {
+#ifdef _MSC_VER
+	int info[4];
+
+	// the OS has to save the ymm registers as well (OSXSAVE and XCR0)
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool hostSupportsAvx512() {
+#ifdef _MSC_VER
+	int info[4];
+
+	// the zmm registers and the mask registers have to be saved by the OS too
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 0xE6) != 0xE6) {
+		return false;
+	}
+
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+
+	// AVX512F and AVX512BW
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+}
+#endif
+
+SpriteBlitFunction selectSpriteBlit() {
+#if CHIP8_SIMD_SUPPORTED
+	if (hostSupportsAvx2()) {
+		return &blitSpriteAvx2;
+	}
+
+	// every x86-64 cpu has SSE2, on 32 bit hosts it is assumed like MSVC does
+	return &blitSpriteSse2;
+#else
+	return &blitSpriteScalar;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CHIP8_SIMD_SUPPORTED 1
+#else
+#define CHIP8_SIMD_SUPPORTED 0
+#endif
+
+/* XORs the n bytes of sprite into the 32 rows of display, byte i goes to row
+y + i shifted right by x (see Machine::display). With wrap the rows and
+pixels past the edges continue on the other side, otherwise they are cut
+off. x has to be below 64 and y below 32. Returns the pixels that were
+turned off*/
+using SpriteBlitFunction = uint64_t (*)(uint64_t* display, const uint8_t* sprite, int n, int x, int y, bool wrap);
+
+uint64_t blitSpriteScalar(uint64_t* display, const uint8_t* sprite, int n, int x, int y, bool wrap);
+
+#if CHIP8_SIMD_SUPPORTED
+// two rows per instruction
+uint64_t blitSpriteSse2(uint64_t* display, const uint8_t* sprite, int n, int x, int y, bool wrap);
+
+// four rows per instruction
+uint64_t blitSpriteAvx2(uint64_t* display, const uint8_t* sprite, int n, int x, int y, bool wrap);
+
+// checked with CPUID, including whether the OS saves the wider registers
+bool hostSupportsAvx2();
+
+// AVX-512F and AVX-512BW, the byte instructions
+bool hostSupportsAvx512();
+#endif
+
+// the fastest of the functions above the host supports, checked with CPUID
+SpriteBlitFunction selectSpriteBlit();
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "vecEnv.h"
+#include <cstring>
+
+namespace {
+	/* the 8 pixels of a display byte as bytes of 0 or 1, the highest bit is
+	the leftmost pixel*/
+	struct PixelTable {
+		uint8_t pixels[256][8];
+
+		PixelTable() {
+			for (int byte = 0; byte < 256; ++byte) {
+				for (int x = 0; x < 8; ++x) {
+					pixels[byte][x] = (byte >> (7 - x)) & 1;
+				}
+			}
+		}
+	};
+
+	const PixelTable pixelTable;
+}
+
+VecEnv::VecEnv(const uint8_t* program, int programLength, int envs, const VecEnvConfig& config) :
+	envs(envs), config(config), lockstep(program, programLength, envs) {
+	loadProgram(initial, program, programLength);
+
+	// the timers tick at the end of every frame in step
+	lockstep.cyclesPerTick = 0;
+
+	scores = new uint64_t[envs]();
+	episodeFrames = new uint64_t[envs]();
+
+	reset(nullptr, nullptr);
+}
+
+VecEnv::~VecEnv() {
+	delete[] scores;
+	delete[] episodeFrames;
+}
+
+void VecEnv::reset(const uint64_t* seeds, uint8_t* observations) {
+	for (int env = 0; env < envs; ++env) {
+		restart(env, randomStateFromSeed(seeds != nullptr ? seeds[env] : env));
+	}
+
+	writeObservations(observations);
+}
+
+void VecEnv::step(const uint8_t* actions, uint8_t* observations, float* rewards, uint8_t* dones) {
+	// the key is held for the whole step
+	for (int env = 0; env < envs; ++env) {
+		for (int key = 0; key < 16; ++key) {
+			lockstep.keyboard[key][env] = actions[env] == key ? 1 : 0;
+		}
+	}
+
+	for (int frame = 0; frame < config.framesPerStep; ++frame) {
+		for (int env = 0; env < envs; ++env) {
+			if (actions[env] < 16) {
+				lockstep.keyPressed(env, actions[env]);
+			}
+		}
+
+		lockstep.runCycles(config.instructionsPerFrame);
+		lockstep.tickTimers();
+	}
+
+	for (int env = 0; env < envs; ++env) {
+		episodeFrames[env] += config.framesPerStep;
+
+		// the difference as a signed number, the score may go down
+		uint64_t score = readScore(env);
+		rewards[env] = static_cast<float>(static_cast<int64_t>(score - scores[env]));
+		scores[env] = score;
+
+		dones[env] = isDone(env) ? 1 : 0;
+		if (dones[env] != 0) {
+			restart(env, lockstep.randomState[env]);
+		}
+	}
+
+	writeObservations(observations);
+}
+
+const uint64_t* VecEnv::packedObservations() const {
+	return lockstep.display;
+}
+
+LockstepEmulator& VecEnv::emulator() {
+	return lockstep;
+}
+
+uint64_t VecEnv::readScore(int env) {
+	const uint8_t* memory = lockstep.laneMemory(env);
+	uint64_t score = 0;
+
+	// more bytes than fit in score are not read
+	int bytes = config.scoreBytes < 8 ? config.scoreBytes : 8;
+
+	for (int i = 0; i < bytes; ++i) {
+		score = (score << 8) | memory[(config.scoreAddress + i) & Machine::addressMask];
+	}
+
+	return score;
+}
+
+bool VecEnv::isDone(int env) {
+	if (!lockstep.isRunning(env)) {
+		return true;
+	}
+	if (config.maxEpisodeFrames != 0 && episodeFrames[env] >= config.maxEpisodeFrames) {
+		return true;
+	}
+
+	return config.doneAddress >= 0 &&
+		lockstep.laneMemory(env)[config.doneAddress & Machine::addressMask] == config.doneValue;
+}
+
+void VecEnv::restart(int env, uint64_t randomState) {
+	initial.randomState = randomState;
+	lockstep.restore(env, initial);
+
+	episodeFrames[env] = 0;
+	scores[env] = readScore(env);
+}
+
+void VecEnv::writeObservations(uint8_t* observations) const {
+	if (observations == nullptr) {
+		return;
+	}
+
+	const uint64_t* rows = lockstep.display;
+	size_t count = static_cast<size_t>(envs) * Machine::displayY;
+
+	// every row of every env, one table lookup per 8 pixels
+	for (size_t row = 0; row < count; ++row) {
+		uint64_t bits = rows[row];
+		uint8_t* out = observations + row * Machine::displayX;
+
+		for (int x = 0; x < Machine::displayX; x += 8) {
+			std::memcpy(out + x, pixelTable.pixels[(bits >> (56 - x)) & 0xFF], 8);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include "lockstep.h"
+
+// what a step of VecEnv does and how reward and done are read from memory
+struct VecEnvConfig {
+	// 60Hz frames per step, the timers tick once at the end of every frame
+	int framesPerStep = 4;
+	int instructionsPerFrame = 10;
+
+	/* the score is the big endian number of scoreBytes bytes at scoreAddress,
+	the reward of a step is how much it changed. 0 bytes means no reward, at
+	most 8 bytes are read*/
+	uint16_t scoreAddress = 0;
+	int scoreBytes = 0;
+
+	/* an episode is over once the byte at doneAddress is doneValue, -1 turns
+	this off. It is also over when the ROM runs into an unknown opcode*/
+	int doneAddress = -1;
+	uint8_t doneValue = 0;
+
+	// frames after which an episode is over, 0 for no limit
+	uint64_t maxEpisodeFrames = 0;
+};
+
+/* a batch of environments of one ROM for reinforcement learning, in the
+style of the vectorized environments of gym. All of them run on one
+LockstepEmulator, so a step of every environment costs a few microseconds
+and never touches a window.
+
+Observations are written straight into a buffer of the caller with one byte
+per pixel, uint8_t[envs][Machine::displayY][Machine::displayX] with 1 for a
+pixel that is on. A caller that can use the bits as they are passes nullptr
+and reads packedObservations, which is the display of the emulator itself*/
+class VecEnv {
+public:
+	// the action that presses no key
+	static const uint8_t noAction = 0xFF;
+
+	const int envs;
+	const VecEnvConfig config;
+
+	VecEnv(const uint8_t* program, int programLength, int envs, const VecEnvConfig& config);
+	~VecEnv();
+
+	VecEnv(const VecEnv&) = delete;
+	VecEnv& operator=(const VecEnv&) = delete;
+
+	/* starts a new episode in every environment, Cxkk of env e is seeded with
+	seeds[e], or with e if seeds is nullptr*/
+	void reset(const uint64_t* seeds, uint8_t* observations);
+
+	/* holds the key actions[e] (0 to 15, or noAction) in env e for
+	config.framesPerStep frames. A held key also answers Fx0A once per frame.
+	rewards and dones have one entry per env, observations may be nullptr.
+
+	An env whose episode is over has dones[e] = 1 and is started again right
+	away, its observation is the first one of the new episode. The new episode
+	goes on with the random numbers of the old one, so it plays differently*/
+	void step(const uint8_t* actions, uint8_t* observations, float* rewards, uint8_t* dones);
+
+	/* Machine::displayY words per env, env after env, the pixel at x of row y
+	is bit 63 - x. Valid until the next step or reset*/
+	const uint64_t* packedObservations() const;
+
+	// the emulator the environments run on, e.g. to snapshot one of them
+	LockstepEmulator& emulator();
+
+private:
+	LockstepEmulator lockstep;
+
+	// the state every episode starts from
+	Machine initial;
+
+	// per env, the score after the last step and the frames of the episode
+	uint64_t* scores;
+	uint64_t* episodeFrames;
+
+	uint64_t readScore(int env);
+	bool isDone(int env);
+
+	// restores env to the initial state, Cxkk goes on from randomState
+	void restart(int env, uint64_t randomState);
+
+	void writeObservations(uint8_t* observations) const;
+};
\ No newline at end of file